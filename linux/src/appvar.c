@@ -0,0 +1,70 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: TI-84 Plus CE AppVar (.8xv) files
+ *--------------------------------------
+*/
+
+#include "appvar.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#define APPVAR_TYPE 0x15
+#define APPVAR_ARCHIVED 0x80
+#define APPVAR_ENTRY_HEADER 0x0D
+
+int appvar_valid_prefix(const char *prefix) {
+    size_t length = strlen(prefix);
+    if ((length == 0) || (length > APPVAR_PREFIX_LENGTH) || !isalpha((unsigned char)prefix[0])) {
+        return 0;
+    }
+    for (size_t i = 1; i < length; i++) {
+        if (!isalnum((unsigned char)prefix[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void appvar_name(char *name, const char *prefix, int part) {
+    snprintf(name, APPVAR_NAME_LENGTH + 1, "%s%02d", prefix, part);
+}
+
+unsigned long appvar_sum(const unsigned char *data, size_t size) {
+    unsigned long sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+static void put_u16(unsigned char *dst, unsigned int value) {
+    dst[0] = (unsigned char)(value & 0xFF);
+    dst[1] = (unsigned char)((value >> 8) & 0xFF);
+}
+
+unsigned int appvar_head(unsigned char *head, const char *name, size_t size, unsigned long data_sum) {
+    static const unsigned char signature[11] = { '*', '*', 'T', 'I', '8', '3', 'F', '*', 0x1A, 0x0A, 0x00 };
+    unsigned int variable_size = (unsigned int)size + 2;
+
+    memset(head, 0, APPVAR_HEAD_SIZE);
+    memcpy(head, signature, sizeof(signature));
+    snprintf((char *)head + 11, 42, "FBin video %s", name);
+    put_u16(head + 53, variable_size + 17);
+
+    unsigned char *entry = head + APPVAR_FILE_HEADER_SIZE;
+    put_u16(entry, APPVAR_ENTRY_HEADER);
+    put_u16(entry + 2, variable_size);
+    entry[4] = APPVAR_TYPE;
+    memcpy(entry + 5, name, strlen(name));
+    entry[13] = 0;
+    entry[14] = APPVAR_ARCHIVED;
+    put_u16(entry + 15, variable_size);
+    put_u16(entry + 17, (unsigned int)size);
+
+    return (unsigned int)((appvar_sum(entry, APPVAR_HEAD_SIZE - APPVAR_FILE_HEADER_SIZE) + data_sum) & 0xFFFF);
+}
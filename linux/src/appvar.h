@@ -0,0 +1,42 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: TI-84 Plus CE AppVar (.8xv) files
+ *--------------------------------------
+*/
+
+#ifndef FBIN_APPVAR_H
+#define FBIN_APPVAR_H
+
+#include <stddef.h>
+
+//largest appvar the os takes, in data bytes
+#define APPVAR_MAX_SIZE 65512
+#define APPVAR_MIN_SIZE 1024
+//names are up to 8 characters: the prefix, then a two digit part number
+#define APPVAR_NAME_LENGTH 8
+#define APPVAR_PREFIX_LENGTH 6
+#define APPVAR_MAX_PARTS 100
+
+//a .8xv file is the head, the data and a u16 checksum:
+//  file header: "**TI83F*", 1A 0A 00, comment (42 bytes), entry section size (u16)
+//  entry: 000D, data size + 2 (u16), type 15 (appvar), name (8 bytes), version 0,
+//         flag 80 (archived), data size + 2 (u16)
+//  then the data's own size (u16)
+//the checksum is the low 16 bits of the sum of every byte after the file header
+#define APPVAR_FILE_HEADER_SIZE 55
+#define APPVAR_HEAD_SIZE 74
+#define APPVAR_CHECKSUM_SIZE 2
+
+//1 when 'prefix' is 1 - APPVAR_PREFIX_LENGTH letters and digits, starting with a letter
+int appvar_valid_prefix(const char *prefix);
+//'name' holds APPVAR_NAME_LENGTH + 1 bytes
+void appvar_name(char *name, const char *prefix, int part);
+//sum of the bytes, for building the checksum as the data is written
+unsigned long appvar_sum(const unsigned char *data, size_t size);
+//fills in the head of a part holding 'size' data bytes that sum to 'data_sum', returns its checksum
+unsigned int appvar_head(unsigned char *head, const char *name, size_t size, unsigned long data_sum);
+
+#endif
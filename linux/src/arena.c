@@ -0,0 +1,115 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Per-thread bump allocator
+ *--------------------------------------
+*/
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 64
+#define ARENA_MIN_CHUNK (256 * 1024)
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+static _Thread_local Arena *thread_arena;
+
+static ArenaChunk *chunk_create(size_t size) {
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size);
+    if (chunk) {
+        chunk->next = NULL;
+        chunk->size = size;
+        chunk->used = 0;
+    }
+    return chunk;
+}
+
+void arena_init(Arena *a) {
+    a->chunks = NULL;
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    ArenaChunk *chunk = a->chunks;
+    if (!chunk || (chunk->size - chunk->used < size)) {
+        //grow geometrically so a new frame size settles after a few chunks
+        size_t chunk_size = chunk ? (chunk->size * 2) : ARENA_MIN_CHUNK;
+        if (chunk_size < size) {
+            chunk_size = size;
+        }
+        chunk = chunk_create(chunk_size);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = a->chunks;
+        a->chunks = chunk;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void arena_reset(Arena *a) {
+    if (!a->chunks) {
+        return;
+    }
+    if (a->chunks->next) {
+        //the last frame spilled over: replace the chain with one chunk that fits it all
+        size_t total = 0;
+        for (ArenaChunk *chunk = a->chunks; chunk; chunk = chunk->next) {
+            total += chunk->size;
+        }
+        arena_destroy(a);
+        a->chunks = chunk_create(total);
+        return;
+    }
+    a->chunks->used = 0;
+}
+
+void arena_destroy(Arena *a) {
+    ArenaChunk *chunk = a->chunks;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    a->chunks = NULL;
+}
+
+void arena_set_thread(Arena *a) {
+    thread_arena = a;
+}
+
+void *arena_thread_malloc(size_t size) {
+    return thread_arena ? arena_alloc(thread_arena, size) : malloc(size);
+}
+
+void *arena_thread_realloc(void *ptr, size_t old_size, size_t new_size) {
+    if (!thread_arena) {
+        return realloc(ptr, new_size);
+    }
+    void *grown = arena_alloc(thread_arena, new_size);
+    if (grown && ptr) {
+        memcpy(grown, ptr, (old_size < new_size) ? old_size : new_size);
+    }
+    return grown;
+}
+
+void arena_thread_free(void *ptr) {
+    //arena memory goes away with the next arena_reset
+    if (!thread_arena) {
+        free(ptr);
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Per-thread bump allocator
+ *--------------------------------------
+*/
+
+#ifndef FBIN_ARENA_H
+#define FBIN_ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaChunk ArenaChunk;
+
+//hands out memory by bumping a pointer, nothing is freed until arena_reset
+//once a frame has run through, one chunk holds everything the next frame needs
+typedef struct {
+    ArenaChunk *chunks;     //newest first, only the newest one is allocated from
+} Arena;
+
+void arena_init(Arena *a);
+//returns NULL when the system is out of memory
+void *arena_alloc(Arena *a, size_t size);
+//forgets every allocation, keeping (and if needed merging) the chunks
+void arena_reset(Arena *a);
+void arena_destroy(Arena *a);
+
+//libimagequant and stb_image take plain malloc / free hooks without a context
+//pointer, so each thread points them at its own arena. with no arena set they
+//fall through to malloc / free
+void arena_set_thread(Arena *a);
+void *arena_thread_malloc(size_t size);
+void *arena_thread_realloc(void *ptr, size_t old_size, size_t new_size);
+void arena_thread_free(void *ptr);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Frame compression for the v2 output
+ *--------------------------------------
+*/
+
+#include "compress.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define RLE_MAX_LITERALS 128
+#define RLE_MIN_RUN 3
+#define RLE_MAX_RUN 129
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+//a match can't start in the last 12 bytes (lz4's rule, so stock decoders can copy in blocks)
+#define LZ_MATCH_LIMIT 12
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+int parse_compress_mode(const char *str, CompressMode *mode) {
+    if (strcmp(str, "none") == 0) {
+        *mode = COMPRESS_NONE;
+    } else if (strcmp(str, "rle") == 0) {
+        *mode = COMPRESS_RLE;
+    } else if (strcmp(str, "lz") == 0) {
+        *mode = COMPRESS_LZ;
+    } else if (strcmp(str, "best") == 0) {
+        *mode = COMPRESS_BEST;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+static size_t run_length(const unsigned char *src, size_t size, size_t pos) {
+    size_t run = 1;
+    while ((pos + run < size) && (run < RLE_MAX_RUN) && (src[pos + run] == src[pos])) {
+        run++;
+    }
+    return run;
+}
+
+int rle_compress(const unsigned char *src, size_t size, unsigned char *dst, size_t limit, size_t *out_size) {
+    size_t out = 0;
+    size_t pos = 0;
+
+    while (pos < size) {
+        size_t run = run_length(src, size, pos);
+        if (run >= RLE_MIN_RUN) {
+            if (out + 2 >= limit) {
+                return 1;
+            }
+            dst[out++] = (unsigned char)(0x80 + run - 2);
+            dst[out++] = src[pos];
+            pos += run;
+            continue;
+        }
+
+        //literals up to the next run worth a control byte of its own
+        size_t count = 0;
+        while ((pos + count < size) && (count < RLE_MAX_LITERALS) &&
+               (run_length(src, size, pos + count) < RLE_MIN_RUN)) {
+            count++;
+        }
+        if (out + 1 + count >= limit) {
+            return 1;
+        }
+        dst[out++] = (unsigned char)(count - 1);
+        memcpy(dst + out, src + pos, count);
+        out += count;
+        pos += count;
+    }
+    *out_size = out;
+    return 0;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline size_t length_bytes(size_t length) {
+    return (length >= 15) ? ((length - 15) / 255) + 1 : 0;
+}
+
+static unsigned char *put_length(unsigned char *dst, size_t length) {
+    length -= 15;
+    while (length >= 255) {
+        *dst++ = 255;
+        length -= 255;
+    }
+    *dst++ = (unsigned char)length;
+    return dst;
+}
+
+//one lz4 sequence, 'match' is 0 for the closing literals
+static int put_sequence(unsigned char **dst, const unsigned char *end, const unsigned char *literals,
+                        size_t literal_count, size_t offset, size_t match) {
+    size_t match_code = match ? (match - LZ_MIN_MATCH) : 0;
+    size_t need = 1 + length_bytes(literal_count) + literal_count + (match ? (2 + length_bytes(match_code)) : 0);
+    unsigned char *out = *dst;
+    if (out + need >= end) {
+        return 1;
+    }
+
+    *out++ = (unsigned char)(((literal_count < 15) ? literal_count : 15) << 4 | ((match_code < 15) ? match_code : 15));
+    if (literal_count >= 15) {
+        out = put_length(out, literal_count);
+    }
+    memcpy(out, literals, literal_count);
+    out += literal_count;
+    if (match) {
+        *out++ = (unsigned char)(offset & 0xFF);
+        *out++ = (unsigned char)(offset >> 8);
+        if (match_code >= 15) {
+            out = put_length(out, match_code);
+        }
+    }
+    *dst = out;
+    return 0;
+}
+
+int lz_compress(const unsigned char *src, size_t size, unsigned char *dst, size_t limit, size_t *out_size) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    unsigned char *out = dst;
+    const unsigned char *end = dst + limit;
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    //greedy, one candidate per hash: fast enough to run on every frame
+    memset(table, 0, sizeof(table));
+    while (size > LZ_MATCH_LIMIT && pos < size - LZ_MATCH_LIMIT) {
+        uint32_t sequence = read32(src + pos);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)pos;
+
+        if ((candidate >= pos) || (pos - candidate > LZ_MAX_OFFSET) || (read32(src + candidate) != sequence)) {
+            pos++;
+            continue;
+        }
+        size_t match = LZ_MIN_MATCH;
+        while ((pos + match < size - LZ_LAST_LITERALS) && (src[candidate + match] == src[pos + match])) {
+            match++;
+        }
+        if (put_sequence(&out, end, src + anchor, pos - anchor, pos - candidate, match)) {
+            return 1;
+        }
+        pos += match;
+        anchor = pos;
+    }
+    if (put_sequence(&out, end, src + anchor, size - anchor, 0, 0)) {
+        return 1;
+    }
+    *out_size = (size_t)(out - dst);
+    return 0;
+}
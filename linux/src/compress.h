@@ -0,0 +1,33 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Frame compression for the v2 output
+ *--------------------------------------
+*/
+
+#ifndef FBIN_COMPRESS_H
+#define FBIN_COMPRESS_H
+
+#include <stddef.h>
+
+typedef enum {
+    COMPRESS_NONE,  //raw indices or runs against the previous frame
+    COMPRESS_RLE,   //also try rle
+    COMPRESS_LZ,    //also try lz
+    COMPRESS_BEST   //try both, keep the smallest
+} CompressMode;
+
+int parse_compress_mode(const char *str, CompressMode *mode);
+
+//both codecs are byte aligned with no bit reading, so an eZ80 decoder is a few copy loops.
+//they return 1 (and give up) as soon as the output would reach 'limit' bytes
+
+//control byte c: c < 0x80 = c + 1 literal bytes follow, otherwise the next byte repeats c - 0x7E times
+int rle_compress(const unsigned char *src, size_t size, unsigned char *dst, size_t limit, size_t *out_size);
+//lz4 block format: token (literal length << 4 | match length - 4), 255-extended lengths,
+//literals, u16 offset. the last 5 bytes are always literals
+int lz_compress(const unsigned char *src, size_t size, unsigned char *dst, size_t limit, size_t *out_size);
+
+#endif
@@ -0,0 +1,783 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Frame extraction (ffmpeg)
+ *--------------------------------------
+*/
+
+#include "decode.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+
+#ifdef FBIN_LIBAV
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/log.h>
+#include <libswscale/swscale.h>
+#endif
+
+#define FFMPEG_COMMAND_LENGTH 512
+
+#ifdef FBIN_LIBAV
+static void libav_source_close(LibavSource *src);
+#endif
+
+static int build_ffmpeg_command(char *command, size_t size, const DecodeOptions *opts, const char *global_flags, const char *output) {
+    //the filter graph and timing flags are shared by every output mode
+    int len;
+    if (opts->stop_string != NULL) {
+        len = snprintf(command, size,
+                "ffmpeg %s-i %s -ss %s -to %s -vf \"scale=%d:%d, lutrgb=r='if(gte(val,0.5),val,val*%d)':g='if(gte(val,0.5),val,val*%d)':b='if(gte(val,0.5),val,val*%d)'\" -r %1f %s",
+                global_flags, opts->input_filename, opts->start_string, opts->stop_string, opts->scale_x, opts->scale_y,
+                opts->min_brightness, opts->min_brightness, opts->min_brightness, opts->framerate, output);
+    }
+    else {
+        len = snprintf(command, size,
+                "ffmpeg %s-i %s -ss %s -vf \"scale=%d:%d, lutrgb=r='if(gte(val,0.5),val,val*%d)':g='if(gte(val,0.5),val,val*%d)':b='if(gte(val,0.5),val,val*%d)'\" -r %1f %s",
+                global_flags, opts->input_filename, opts->start_string, opts->scale_x, opts->scale_y,
+                opts->min_brightness, opts->min_brightness, opts->min_brightness, opts->framerate, output);
+    }
+
+    if ((len < 0) || ((size_t)len >= size)) {
+        fprintf(stderr, "ffmpeg command is too long\n");
+        return 1;
+    }
+    return 0;
+}
+
+int parse_decoder_type(const char *str, DecoderType *type) {
+    if (strcmp(str, "png") == 0) {
+        *type = DECODER_PNG;
+    } else if (strcmp(str, "pipe") == 0) {
+        *type = DECODER_PIPE;
+    } else if (strcmp(str, "libav") == 0) {
+        *type = DECODER_LIBAV;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+int parse_time_string(const char *str, double *seconds) {
+    double parts[3];
+    int count = 0;
+    const char *p = str;
+
+    //split on ':' from the left, so "5", "01:05" and "00:01:05.5" all work
+    while (count < 3) {
+        char *end;
+        parts[count++] = strtod(p, &end);
+        if (end == p) {
+            return 1;
+        }
+        if (*end == '\0') {
+            break;
+        }
+        if (*end != ':') {
+            return 1;
+        }
+        p = end + 1;
+    }
+
+    *seconds = 0.0;
+    for (int i = 0; i < count; i++) {
+        *seconds = (*seconds * 60.0) + parts[i];
+    }
+    return (*seconds < 0.0);
+}
+
+int extract_png_frames(const DecodeOptions *opts, const char *frames_folder, const char *frame_name) {
+    char ffmpeg_command[FFMPEG_COMMAND_LENGTH];
+    char output[FFMPEG_COMMAND_LENGTH];
+
+    snprintf(output, sizeof(output), "%s/%s_%%d.png", frames_folder, frame_name);
+    if (build_ffmpeg_command(ffmpeg_command, sizeof(ffmpeg_command), opts, "", output)) {
+        return 1;
+    }
+
+    int ffmpeg_err = system(ffmpeg_command);
+    if (!ffmpeg_err) {
+        printf("ffmpeg command executed successfully\n");
+    }
+    else {
+        perror("ffmpeg command failed");
+        fprintf(stderr, "; error code: %d\n", ffmpeg_err);
+        return 1;
+    }
+    return 0;
+}
+
+int frame_pipe_open(FramePipe *fp, const DecodeOptions *opts) {
+    char ffmpeg_command[FFMPEG_COMMAND_LENGTH];
+
+    fp->pipe = NULL;
+    fp->frame_size = (size_t)opts->scale_x * opts->scale_y * 4;
+    fp->frames_read = 0;
+
+    //-nostdin keeps ffmpeg away from the terminal, the progress line is ours
+    if (build_ffmpeg_command(ffmpeg_command, sizeof(ffmpeg_command), opts,
+                             "-nostdin -loglevel error ", "-f rawvideo -pix_fmt rgba -")) {
+        return 1;
+    }
+
+    fp->pipe = popen(ffmpeg_command, "r");
+    if (fp->pipe == NULL) {
+        perror("failed to start ffmpeg");
+        return 1;
+    }
+    printf("streaming frames from ffmpeg\n");
+    return 0;
+}
+
+int frame_pipe_read(FramePipe *fp, unsigned char *rgba) {
+    size_t got = fread(rgba, 1, fp->frame_size, fp->pipe);
+    if (got != fp->frame_size) {
+        if (got != 0) {
+            fprintf(stderr, "ffmpeg stream ended mid-frame (%zu of %zu bytes)\n", got, fp->frame_size);
+        }
+        return 0;
+    }
+    fp->frames_read++;
+    return 1;
+}
+
+int frame_pipe_close(FramePipe *fp) {
+    if (fp->pipe == NULL) {
+        return 0;
+    }
+    int ffmpeg_err = pclose(fp->pipe);
+    fp->pipe = NULL;
+    if (ffmpeg_err) {
+        fprintf(stderr, "ffmpeg exited with error code: %d\n", ffmpeg_err);
+        return 1;
+    }
+    return 0;
+}
+
+#ifdef FBIN_LIBAV
+
+struct LibavSource {
+    AVFormatContext *fmt;
+    AVCodecContext *dec;
+    struct SwsContext *sws;
+    AVPacket *pkt;
+    int stream_index;
+    int flushing;
+    int ended;
+    int used;                   //decoded before, so the next range always seeks
+
+    //cur is the frame shown in the current output slot, next is the one after it
+    AVFrame *cur;
+    AVFrame *next;
+    int have_cur, have_next;
+    long long cur_slot, next_slot;
+    long long out_slot;
+    long long end_slot;         //first slot past this source's range, negative for none
+    double last_time;
+
+    double start_time;
+    double stop_time;           //negative when there is no -to
+    double stream_offset;       //container start time, subtracted like ffmpeg does
+    double framerate;
+    double default_duration;
+    int scale_x, scale_y;
+    unsigned char brightness_lut[256];
+};
+
+static int libav_decode_next(LibavSource *src, AVFrame *frame) {
+    //returns 1 with a frame, 0 once the decoder is drained, -1 on error
+    for (;;) {
+        int ret = avcodec_receive_frame(src->dec, frame);
+        if (ret == 0) {
+            return 1;
+        }
+        if (ret == AVERROR_EOF) {
+            return 0;
+        }
+        if (ret != AVERROR(EAGAIN)) {
+            fprintf(stderr, "decoding failed: %s\n", av_err2str(ret));
+            return -1;
+        }
+
+        ret = av_read_frame(src->fmt, src->pkt);
+        if (ret < 0) {
+            //end of file, drain the frames still inside the decoder threads
+            if (src->flushing) {
+                return 0;
+            }
+            src->flushing = 1;
+            avcodec_send_packet(src->dec, NULL);
+            continue;
+        }
+        if (src->pkt->stream_index == src->stream_index) {
+            ret = avcodec_send_packet(src->dec, src->pkt);
+            if (ret < 0) {
+                //like ffmpeg, skip broken packets instead of stopping
+                fprintf(stderr, "skipping bad packet: %s\n", av_err2str(ret));
+            }
+        }
+        av_packet_unref(src->pkt);
+    }
+}
+
+static int libav_decode_timed(LibavSource *src, AVFrame *frame, long long *slot) {
+    //decodes the next frame inside [start, stop) and maps it to an output slot
+    while (!src->ended) {
+        int ret = libav_decode_next(src, frame);
+        if (ret <= 0) {
+            src->ended = 1;
+            return ret;
+        }
+
+        double time;
+        if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+            AVRational time_base = src->fmt->streams[src->stream_index]->time_base;
+            time = (frame->best_effort_timestamp * av_q2d(time_base)) - src->stream_offset;
+        }
+        else {
+            time = src->last_time + src->default_duration;
+        }
+        src->last_time = time;
+
+        if ((src->stop_time >= 0.0) && (time >= src->stop_time)) {
+            src->ended = 1;
+            return 0;
+        }
+        if (time < src->start_time) {
+            continue;
+        }
+        *slot = llround((time - src->start_time) * src->framerate);
+        return 1;
+    }
+    return 0;
+}
+
+static int libav_seek(LibavSource *src, double time) {
+    //jump to the keyframe before 'time', the frames in between are decoded and dropped
+    if (time < 0.0) {
+        time = 0.0;
+    }
+    int64_t target = (int64_t)((time + src->stream_offset) * AV_TIME_BASE);
+    if (av_seek_frame(src->fmt, -1, target, AVSEEK_FLAG_BACKWARD) < 0) {
+        return 1;
+    }
+    avcodec_flush_buffers(src->dec);
+    src->flushing = 0;
+    src->ended = 0;
+    src->last_time = time - src->default_duration;
+    return 0;
+}
+
+static int libav_source_set_range(LibavSource *src, long long first_slot, long long end_slot) {
+    //positions the decoder so the next read returns first_slot
+    av_frame_unref(src->cur);
+    av_frame_unref(src->next);
+    src->have_cur = 0;
+    src->have_next = 0;
+    src->out_slot = first_slot;
+    src->end_slot = end_slot;
+
+    //the frame shown in first_slot must be decoded, so if the demuxer lands
+    //past it (inexact seeking in formats without an index) back off further
+    double seek_time = src->start_time + (first_slot / src->framerate);
+    double back_off = 0.0;
+    for (int attempt = 0; ; attempt++) {
+        if (((seek_time > 0.0) || src->used) && libav_seek(src, seek_time - back_off)) {
+            //the caller ends the output before this range rather than decode the wrong frames
+            fprintf(stderr, "failed to seek to frame %lld\n", first_slot + 1);
+            return 1;
+        }
+        src->used = 1;
+        int ret = libav_decode_timed(src, src->next, &src->next_slot);
+        if (ret < 0) {
+            return 1;
+        }
+        src->have_next = ret;
+        if ((first_slot == 0) || !src->have_next || (src->next_slot <= first_slot) || (seek_time - back_off <= 0.0)) {
+            break;
+        }
+        back_off = (attempt < 2) ? (back_off * 4.0) + 1.0 : seek_time;
+    }
+    return 0;
+}
+
+static int libav_source_open(LibavSource **out, const DecodeOptions *opts, int threads) {
+    LibavSource *src = calloc(1, sizeof(LibavSource));
+    const AVCodec *codec = NULL;
+    int ret;
+
+    *out = NULL;
+    if (!src) {
+        return 1;
+    }
+    src->scale_x = opts->scale_x;
+    src->scale_y = opts->scale_y;
+    src->framerate = opts->framerate;
+    src->stop_time = -1.0;
+    if (parse_time_string(opts->start_string, &src->start_time) ||
+        ((opts->stop_string != NULL) && parse_time_string(opts->stop_string, &src->stop_time))) {
+        fprintf(stderr, "Error: Invalid time format. Expected HH:MM:SS or seconds\n");
+        libav_source_close(src);
+        return 1;
+    }
+
+    //same curve as the lutrgb filter used on the ffmpeg command line
+    for (int v = 0; v < 256; v++) {
+        int out_value = (v >= 0.5) ? v : v * opts->min_brightness;
+        src->brightness_lut[v] = (unsigned char)((out_value > 255) ? 255 : out_value);
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    if ((ret = avformat_open_input(&src->fmt, opts->input_filename, NULL, NULL)) < 0) {
+        fprintf(stderr, "failed to open '%s': %s\n", opts->input_filename, av_err2str(ret));
+        libav_source_close(src);
+        return 1;
+    }
+    if ((ret = avformat_find_stream_info(src->fmt, NULL)) < 0) {
+        fprintf(stderr, "failed to read stream info: %s\n", av_err2str(ret));
+        libav_source_close(src);
+        return 1;
+    }
+
+    src->stream_index = av_find_best_stream(src->fmt, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (src->stream_index < 0) {
+        fprintf(stderr, "no video stream in '%s'\n", opts->input_filename);
+        libav_source_close(src);
+        return 1;
+    }
+    for (unsigned int i = 0; i < src->fmt->nb_streams; i++) {
+        //don't demux audio or subtitles we would throw away
+        if ((int)i != src->stream_index) {
+            src->fmt->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    AVStream *stream = src->fmt->streams[src->stream_index];
+
+    src->dec = avcodec_alloc_context3(codec);
+    if (!src->dec || (avcodec_parameters_to_context(src->dec, stream->codecpar) < 0)) {
+        fprintf(stderr, "failed to set up the decoder\n");
+        libav_source_close(src);
+        return 1;
+    }
+    src->dec->pkt_timebase = stream->time_base;
+    src->dec->thread_count = threads;
+    src->dec->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if ((ret = avcodec_open2(src->dec, codec, NULL)) < 0) {
+        fprintf(stderr, "failed to open the decoder: %s\n", av_err2str(ret));
+        libav_source_close(src);
+        return 1;
+    }
+
+    AVRational rate = stream->avg_frame_rate;
+    src->default_duration = ((rate.num > 0) && (rate.den > 0)) ? av_q2d(av_inv_q(rate)) : (1.0 / src->framerate);
+    src->stream_offset = (src->fmt->start_time != AV_NOPTS_VALUE) ? ((double)src->fmt->start_time / AV_TIME_BASE) : 0.0;
+    src->last_time = -src->default_duration;
+
+    src->pkt = av_packet_alloc();
+    src->cur = av_frame_alloc();
+    src->next = av_frame_alloc();
+    if (!src->pkt || !src->cur || !src->next) {
+        libav_source_close(src);
+        return 1;
+    }
+
+    *out = src;
+    return 0;
+}
+
+static int libav_source_read(LibavSource *src, unsigned char *rgba) {
+    //returns 1 when a frame was written to rgba, 0 at the end of the range, -1 on error
+    if ((src->end_slot >= 0) && (src->out_slot >= src->end_slot)) {
+        return 0;
+    }
+
+    //constant frame rate output: slot k shows the last frame that started at or before it
+    while (src->have_next && (!src->have_cur || (src->next_slot <= src->out_slot))) {
+        AVFrame *tmp = src->cur;
+        src->cur = src->next;
+        src->next = tmp;
+        src->cur_slot = src->next_slot;
+        if (!src->have_cur) {
+            //the range starts with the first frame at or after -ss
+            src->have_cur = 1;
+            if (src->out_slot < src->cur_slot) {
+                src->out_slot = src->cur_slot;
+            }
+        }
+
+        av_frame_unref(src->next);
+        int ret = libav_decode_timed(src, src->next, &src->next_slot);
+        if (ret < 0) {
+            return -1;
+        }
+        src->have_next = ret;
+    }
+    if (!src->have_cur || (!src->have_next && (src->out_slot > src->cur_slot))) {
+        return 0;
+    }
+
+    AVFrame *frame = src->cur;
+    src->sws = sws_getCachedContext(src->sws, frame->width, frame->height, frame->format,
+                                    src->scale_x, src->scale_y, AV_PIX_FMT_RGBA,
+                                    SWS_BICUBIC, NULL, NULL, NULL);
+    if (!src->sws) {
+        fprintf(stderr, "failed to set up the scaler\n");
+        return -1;
+    }
+
+    //scale straight into the buffer handed to libimagequant
+    uint8_t *dst[4] = { rgba, NULL, NULL, NULL };
+    int dst_linesize[4] = { src->scale_x * 4, 0, 0, 0 };
+    sws_scale(src->sws, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, dst, dst_linesize);
+
+    size_t pixel_count = (size_t)src->scale_x * src->scale_y;
+    for (size_t i = 0; i < pixel_count; i++) {
+        rgba[(i * 4) + 0] = src->brightness_lut[rgba[(i * 4) + 0]];
+        rgba[(i * 4) + 1] = src->brightness_lut[rgba[(i * 4) + 1]];
+        rgba[(i * 4) + 2] = src->brightness_lut[rgba[(i * 4) + 2]];
+    }
+
+    src->out_slot++;
+    return 1;
+}
+
+static void libav_source_close(LibavSource *src) {
+    if (!src) {
+        return;
+    }
+    sws_freeContext(src->sws);
+    av_frame_free(&src->cur);
+    av_frame_free(&src->next);
+    av_packet_free(&src->pkt);
+    avcodec_free_context(&src->dec);
+    avformat_close_input(&src->fmt);
+    free(src);
+}
+
+struct LibavSegments {
+    int lanes;
+    LibavSource *probe;         //only used for keyframe lookups once the lanes are open
+    LibavSource **sources;      //one decoder per lane
+    int *lane_segment;          //segment each lane is decoding, -1 between segments
+
+    //segment j covers slots [bounds[j], bounds[j + 1]), a negative bound is open-ended
+    long long *bounds;
+    int bounds_count, bounds_capacity;
+    long long segment_frames;
+    long long candidate;
+    int split_failed;
+    int next_segment;
+    long long first_slot;
+    long long end_slot;         //where the first decoder ran out, LLONG_MAX until then
+    double duration;
+};
+
+static double libav_keyframe_before(LibavSource *src, double time) {
+    //looks the keyframe up in the demuxer index, falls back to 'time' without one
+    AVStream *stream = src->fmt->streams[src->stream_index];
+    double time_base = av_q2d(stream->time_base);
+    int64_t timestamp = (int64_t)((time + src->stream_offset) / time_base);
+
+    int index = av_index_search_timestamp(stream, timestamp, AVSEEK_FLAG_BACKWARD);
+    if (index < 0) {
+        return time;
+    }
+    const AVIndexEntry *entry = avformat_index_get_entry(stream, index);
+    if (!entry) {
+        return time;
+    }
+    return (entry->timestamp * time_base) - src->stream_offset;
+}
+
+static long long libav_segments_bound(LibavSegments *seg, int j) {
+    //boundaries are made on demand (inside the critical section), so an unknown duration is fine
+    while (seg->bounds_count <= j) {
+        long long prev = seg->bounds[seg->bounds_count - 1];
+        long long next = -1;
+        if ((prev < 0) || seg->split_failed) {
+            //the previous segment is open-ended, nothing comes after it
+            return -1;
+        }
+
+        while (seg->lanes > 1) {
+            LibavSource *probe = seg->probe;
+            seg->candidate++;
+            long long target_slot = seg->first_slot + (seg->candidate * seg->segment_frames);
+            double target = probe->start_time + (target_slot / probe->framerate);
+            if ((probe->stop_time >= 0.0) && (target >= probe->stop_time)) {
+                break;
+            }
+
+            //snap to a keyframe, rounding up so the seek for it lands on that keyframe
+            double key = libav_keyframe_before(probe, target);
+            long long slot = (long long)ceil(((key - probe->start_time) * probe->framerate) - 1e-6);
+            if (slot > prev) {
+                next = slot;
+                break;
+            }
+            if (target_slot > prev + (16 * seg->segment_frames)) {
+                //past the end of the index (or very long gops), split without snapping
+                next = target_slot;
+                break;
+            }
+        }
+
+        if (seg->bounds_count == seg->bounds_capacity) {
+            long long *bounds = realloc(seg->bounds, (seg->bounds_capacity * 2) * sizeof(long long));
+            if (!bounds) {
+                seg->split_failed = 1;
+                return -1;
+            }
+            seg->bounds = bounds;
+            seg->bounds_capacity *= 2;
+        }
+        seg->bounds[seg->bounds_count++] = next;
+    }
+    return seg->bounds[j];
+}
+
+int libav_segments_open(LibavSegments **out, const DecodeOptions *opts, int threads) {
+    LibavSegments *seg = calloc(1, sizeof(LibavSegments));
+    int lanes = (opts->segments > 1) ? opts->segments : 1;
+
+    *out = NULL;
+    if (!seg) {
+        return 1;
+    }
+    seg->lanes = lanes;
+    seg->end_slot = LLONG_MAX;
+    seg->segment_frames = (opts->segment_frames > 0) ? opts->segment_frames : 1;
+    seg->bounds_capacity = 64;
+    seg->bounds = malloc(seg->bounds_capacity * sizeof(long long));
+    seg->sources = calloc(lanes, sizeof(LibavSource *));
+    seg->lane_segment = malloc(lanes * sizeof(int));
+    if (!seg->bounds || !seg->sources || !seg->lane_segment) {
+        libav_segments_close(seg);
+        return 1;
+    }
+    for (int lane = 0; lane < lanes; lane++) {
+        seg->lane_segment[lane] = -1;
+    }
+
+    //the probe finds the first frame; with a single lane it is also the decoder
+    int lane_threads = (threads / lanes > 0) ? (threads / lanes) : 1;
+    if (libav_source_open(&seg->probe, opts, lane_threads) ||
+        libav_source_set_range(seg->probe, 0, -1)) {
+        libav_segments_close(seg);
+        return 1;
+    }
+    seg->first_slot = (seg->probe->have_next && (seg->probe->next_slot > 0)) ? seg->probe->next_slot : 0;
+    seg->duration = -1.0;
+    if ((seg->probe->fmt->duration != AV_NOPTS_VALUE) && (seg->probe->fmt->duration > 0)) {
+        seg->duration = (double)seg->probe->fmt->duration / AV_TIME_BASE;
+    }
+    seg->bounds[0] = seg->first_slot;
+    seg->bounds_count = 1;
+
+    if (lanes == 1) {
+        //one open-ended segment, already positioned
+        seg->sources[0] = seg->probe;
+        seg->probe = NULL;
+        seg->lane_segment[0] = 0;
+        seg->next_segment = 1;
+        seg->bounds[seg->bounds_count++] = -1;
+        seg->sources[0]->out_slot = seg->first_slot;
+    }
+    else {
+        for (int lane = 0; lane < lanes; lane++) {
+            if (libav_source_open(&seg->sources[lane], opts, lane_threads)) {
+                libav_segments_close(seg);
+                return 1;
+            }
+        }
+    }
+
+    printf("decoding '%s' with %d decoder(s) (%d threads each)\n", opts->input_filename, lanes, lane_threads);
+    *out = seg;
+    return 0;
+}
+
+int libav_segments_lanes(const LibavSegments *seg) {
+    return seg->lanes;
+}
+
+int libav_segments_read(LibavSegments *seg, int lane, unsigned char *rgba, long long *index) {
+    LibavSource *src = seg->sources[lane];
+
+    for (;;) {
+        if (seg->lane_segment[lane] < 0) {
+            //claim the next segment nobody is decoding yet
+            int j = -1;
+            long long from = -1, to = -1;
+            #pragma omp critical(libav_segments)
+            {
+                from = libav_segments_bound(seg, seg->next_segment);
+                if ((from >= 0) && (from < seg->end_slot)) {
+                    j = seg->next_segment++;
+                    to = libav_segments_bound(seg, j + 1);
+                }
+            }
+            if (j < 0) {
+                return 0;
+            }
+            seg->lane_segment[lane] = j;
+            if (libav_source_set_range(src, from, to)) {
+                #pragma omp critical(libav_segments)
+                seg->end_slot = (from < seg->end_slot) ? from : seg->end_slot;
+                return -1;
+            }
+        }
+
+        int ret = libav_source_read(src, rgba);
+        if (ret == 1) {
+            *index = src->out_slot - 1 - seg->first_slot;
+            return 1;
+        }
+
+        //a segment that stops short marks the end, exactly where one long stream would stop
+        if ((ret < 0) || (src->end_slot < 0) || (src->out_slot < src->end_slot)) {
+            #pragma omp critical(libav_segments)
+            seg->end_slot = (src->out_slot < seg->end_slot) ? src->out_slot : seg->end_slot;
+        }
+        seg->lane_segment[lane] = -1;
+        if (ret < 0) {
+            return -1;
+        }
+    }
+}
+
+long long libav_segments_frame_count(const LibavSegments *seg) {
+    return (seg->end_slot == LLONG_MAX) ? 0 : (seg->end_slot - seg->first_slot);
+}
+
+double libav_segments_duration(const LibavSegments *seg) {
+    return seg->duration;
+}
+
+void libav_segments_close(LibavSegments *seg) {
+    if (!seg) {
+        return;
+    }
+    if (seg->sources) {
+        for (int lane = 0; lane < seg->lanes; lane++) {
+            libav_source_close(seg->sources[lane]);
+        }
+    }
+    libav_source_close(seg->probe);
+    free(seg->sources);
+    free(seg->lane_segment);
+    free(seg->bounds);
+    free(seg);
+}
+
+#else
+
+int libav_segments_open(LibavSegments **seg, const DecodeOptions *opts, int threads) {
+    (void)opts;
+    (void)threads;
+    *seg = NULL;
+    fprintf(stderr, "fbin was built without libav support, rebuild with 'make LIBAV=1'\n");
+    return 1;
+}
+
+int libav_segments_lanes(const LibavSegments *seg) {
+    (void)seg;
+    return 1;
+}
+
+int libav_segments_read(LibavSegments *seg, int lane, unsigned char *rgba, long long *index) {
+    (void)seg;
+    (void)lane;
+    (void)rgba;
+    (void)index;
+    return -1;
+}
+
+long long libav_segments_frame_count(const LibavSegments *seg) {
+    (void)seg;
+    return 0;
+}
+
+double libav_segments_duration(const LibavSegments *seg) {
+    (void)seg;
+    return -1.0;
+}
+
+void libav_segments_close(LibavSegments *seg) {
+    (void)seg;
+}
+
+#endif
+
+int frame_stream_open(FrameStream *fs, DecoderType type, const DecodeOptions *opts, int threads) {
+    fs->type = type;
+    fs->failed = 0;
+    fs->libav = NULL;
+    fs->pipe.pipe = NULL;
+    if (type == DECODER_LIBAV) {
+        return libav_segments_open(&fs->libav, opts, threads);
+    }
+    return frame_pipe_open(&fs->pipe, opts);
+}
+
+int frame_stream_lanes(const FrameStream *fs) {
+    return (fs->type == DECODER_LIBAV) ? libav_segments_lanes(fs->libav) : 1;
+}
+
+int frame_stream_read(FrameStream *fs, int lane, unsigned char *rgba, long long *index) {
+    if (fs->type == DECODER_LIBAV) {
+        //a decode error ends the stream, frame_stream_close reports it
+        int ret = libav_segments_read(fs->libav, lane, rgba, index);
+        if (ret < 0) {
+            #pragma omp atomic write
+            fs->failed = 1;
+            return 0;
+        }
+        return ret;
+    }
+
+    if (!frame_pipe_read(&fs->pipe, rgba)) {
+        return 0;
+    }
+    *index = fs->pipe.frames_read - 1;
+    return 1;
+}
+
+long long frame_stream_frame_count(const FrameStream *fs) {
+    if (fs->type == DECODER_LIBAV) {
+        return libav_segments_frame_count(fs->libav);
+    }
+    return fs->pipe.frames_read;
+}
+
+long long frame_stream_expected_frames(const FrameStream *fs, const DecodeOptions *opts) {
+    double start, stop = -1.0;
+    if (parse_time_string(opts->start_string, &start)) {
+        return -1;
+    }
+    if ((opts->stop_string == NULL) || parse_time_string(opts->stop_string, &stop)) {
+        stop = (fs->type == DECODER_LIBAV) ? libav_segments_duration(fs->libav) : -1.0;
+    }
+    if (stop <= start) {
+        return -1;
+    }
+    return (long long)ceil((stop - start) * opts->framerate);
+}
+
+int frame_stream_close(FrameStream *fs) {
+    if (fs->type == DECODER_PIPE) {
+        return frame_pipe_close(&fs->pipe);
+    }
+    libav_segments_close(fs->libav);
+    fs->libav = NULL;
+    return fs->failed;
+}
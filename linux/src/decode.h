@@ -0,0 +1,88 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Frame extraction (ffmpeg)
+ *--------------------------------------
+*/
+
+#ifndef FBIN_DECODE_H
+#define FBIN_DECODE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum {
+    DECODER_PNG,    //ffmpeg writes frames/frame_%d.png, then each png is loaded
+    DECODER_PIPE,   //ffmpeg streams rgba frames over a pipe
+    DECODER_LIBAV   //frames are decoded in-process (needs a LIBAV=1 build)
+} DecoderType;
+
+typedef struct {
+    const char *input_filename;
+    const char *start_string;
+    const char *stop_string;
+    int scale_x, scale_y;
+    float framerate;
+    int min_brightness;
+    int segments;       //concurrent libav decoders over the -ss/-to range
+    int segment_frames; //target length of each decoder's segment, in output frames
+} DecodeOptions;
+
+typedef struct {
+    FILE *pipe;
+    size_t frame_size;
+    int frames_read;
+} FramePipe;
+
+typedef struct LibavSource LibavSource;
+typedef struct LibavSegments LibavSegments;
+
+//a sequential source of scale_x * scale_y rgba frames (pipe or libav)
+typedef struct {
+    DecoderType type;
+    FramePipe pipe;
+    LibavSegments *libav;
+    int failed;
+} FrameStream;
+
+int parse_decoder_type(const char *str, DecoderType *type);
+//accepts HH:MM:SS[.ms], MM:SS[.ms] or plain seconds
+int parse_time_string(const char *str, double *seconds);
+
+//runs ffmpeg once and writes every frame as <frames_folder>/<frame_name>_%d.png
+int extract_png_frames(const DecodeOptions *opts, const char *frames_folder, const char *frame_name);
+
+//spawns ffmpeg writing raw rgba frames (scale_x * scale_y * 4 bytes each) to stdout
+int frame_pipe_open(FramePipe *fp, const DecodeOptions *opts);
+//returns 1 when a full frame was read, 0 at the end of the stream
+int frame_pipe_read(FramePipe *fp, unsigned char *rgba);
+int frame_pipe_close(FramePipe *fp);
+
+//decodes in-process with libavformat/libavcodec, using 'threads' decoder threads in total
+//the range is cut into short keyframe-aligned segments that opts->segments decoders
+//("lanes") claim in turn, each frame keeps the position it has in a single-stream decode
+int libav_segments_open(LibavSegments **seg, const DecodeOptions *opts, int threads);
+int libav_segments_lanes(const LibavSegments *seg);
+//returns 1 with the frame's output index, 0 once the lane has no segments left, -1 on error
+int libav_segments_read(LibavSegments *seg, int lane, unsigned char *rgba, long long *index);
+//only valid once every lane has returned 0
+long long libav_segments_frame_count(const LibavSegments *seg);
+//container duration in seconds, negative when unknown
+double libav_segments_duration(const LibavSegments *seg);
+void libav_segments_close(LibavSegments *seg);
+
+int frame_stream_open(FrameStream *fs, DecoderType type, const DecodeOptions *opts, int threads);
+//number of lanes that can call frame_stream_read at the same time
+int frame_stream_lanes(const FrameStream *fs);
+//returns 1 with the frame's position in the output, 0 once the lane is finished
+//(decode errors also end the lane, frame_stream_close reports them)
+int frame_stream_read(FrameStream *fs, int lane, unsigned char *rgba, long long *index);
+//only valid once every lane is finished
+long long frame_stream_frame_count(const FrameStream *fs);
+//estimate from -to or the container duration before decoding, negative when unknown
+long long frame_stream_expected_frames(const FrameStream *fs, const DecodeOptions *opts);
+int frame_stream_close(FrameStream *fs);
+
+#endif
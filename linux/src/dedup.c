@@ -0,0 +1,115 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Duplicate frame detection
+ *--------------------------------------
+*/
+
+#include "dedup.h"
+
+#include <string.h>
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    return rotl64(acc, 31) * PRIME64_1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t lane) {
+    acc ^= hash_round(0, lane);
+    return (acc * PRIME64_1) + PRIME64_4;
+}
+
+uint64_t frame_hash(const unsigned char *data, size_t size) {
+    const unsigned char *p = data;
+    const unsigned char *end = data + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        //the lanes don't depend on each other, so the stripes pipeline (or vectorize) well
+        uint64_t v1 = PRIME64_1 + PRIME64_2;
+        uint64_t v2 = PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - PRIME64_1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = hash_round(v1, read64(p));
+            v2 = hash_round(v2, read64(p + 8));
+            v3 = hash_round(v3, read64(p + 16));
+            v4 = hash_round(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    }
+    else {
+        h = PRIME64_5;
+    }
+    h += (uint64_t)size;
+
+    //tail
+    for (; p + 8 <= end; p += 8) {
+        h ^= hash_round(0, read64(p));
+        h = (rotl64(h, 27) * PRIME64_1) + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= read32(p) * PRIME64_1;
+        h = (rotl64(h, 23) * PRIME64_2) + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    //avalanche
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+int frames_match(const unsigned char *a, const unsigned char *b, size_t pixel_count, int tolerance) {
+    //1 KB at a time, so a frame that differs early stops early without a branch per byte
+    const size_t chunk = 1024;
+    size_t size = pixel_count * 4;
+    for (size_t start = 0; start < size; start += chunk) {
+        size_t stop = (start + chunk < size) ? (start + chunk) : size;
+        int worst = 0;
+        for (size_t i = start; i < stop; i++) {
+            int diff = (int)a[i] - (int)b[i];
+            diff = (diff < 0) ? -diff : diff;
+            worst = (diff > worst) ? diff : worst;
+        }
+        if (worst > tolerance) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,21 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Duplicate frame detection
+ *--------------------------------------
+*/
+
+#ifndef FBIN_DEDUP_H
+#define FBIN_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//64-bit hash of a frame (xxh64: four independent lanes over 32 byte stripes)
+uint64_t frame_hash(const unsigned char *data, size_t size);
+//1 when no channel of any pixel differs by more than 'tolerance' between the rgba frames
+int frames_match(const unsigned char *a, const unsigned char *b, size_t pixel_count, int tolerance);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Ordered dithering
+ *--------------------------------------
+*/
+
+#include "dither.h"
+
+#include <math.h>
+#include <string.h>
+
+#define TILE_PIXELS (DITHER_TILE * DITHER_TILE)
+
+int parse_dither_mode(const char *str, DitherMode *mode) {
+    if (strcmp(str, "diffusion") == 0) {
+        *mode = DITHER_DIFFUSION;
+    } else if (strcmp(str, "bayer4") == 0) {
+        *mode = DITHER_BAYER4;
+    } else if (strcmp(str, "bayer8") == 0) {
+        *mode = DITHER_BAYER8;
+    } else if (strcmp(str, "bluenoise") == 0) {
+        *mode = DITHER_BLUE_NOISE;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+//rank of (x, y) in a size x size bayer matrix (size a power of two)
+static int bayer_rank(int x, int y, int size) {
+    int rank = 0;
+    for (int bit = size >> 1; bit > 0; bit >>= 1) {
+        int bx = (x & bit) ? 1 : 0, by = (y & bit) ? 1 : 0;
+        rank = (rank << 2) | ((bx ^ by) << 1 | by);
+    }
+    return rank;
+}
+
+//void and cluster ranks (Ulichney, gaussian sigma 1.5, fixed seed) of one DITHER_TILE tile,
+//generated once offline: 0 is the first pixel to light up, TILE_PIXELS - 1 the last
+static const unsigned short blue_noise_rank[TILE_PIXELS] = {
+     474,  555,   24,  635,  835,   82,  722,  224,  869,  123,  927,  246,  503,  892,   14,  472,
+     294,   73,  732,  212,  666,  997,   31,  604,  762,  248,  476,  799,  291,  994,  691,  349,
+     100,  818, 1007,  173,  285,  519,  350,   10,  487,  576,  768,  657,  391,  307,  821,  675,
+    1014,  622,  928,  506,  302,  389,  179,  937,  313,  557,  958,  114,  402,  528,  210,  881,
+     624,  231,  697,  408,  921,  756,  965,  669,  822,  344,  185,   55,  979,  135,  556,  228,
+     412,  149,  355,   43,  832,  586,  703,  464,   93,  863,  182,  602,  845,   49,  767,  422,
+     961,  340,  502,   65,  591,  125,  435,  256,  102, 1020,  457,  851,  515,  736,  923,   63,
+     791,  871,  571,  747,  130,  904,  242,  805,  354,  678,  419,  721,  331,  949,  580,  152,
+      11,  873,  749,  270,  803,  201,  639,  870,  559,  705,  290,  616,  217,  338,  442,  609,
+     297,  477,  196,  992,  418,  520,   53,  975,  539,    6, 1003,  225,   88,  470,  263,  707,
+     534,  186,  631,  982,  462,  896,  335,   61,  379,  156,  812,   21,  946,  672,   98,  753,
+     966,   18,  644,  268,  690,  328,  621,  171,  765,  288,  489,  889,  779,  640,  862,  366,
+     790,  430,  110,  364,   36,  538,  720,  953,  782,  438,  900,  542,  396,  154,  836,  236,
+     523,  348,  784,  916,   72,  883,  739,  387,  935,  645,  112,  567,  382,  168,   69, 1019,
+     593,  233,  912,  817,  687,  150,  275,  496,  213,  652,   90,  243,  761, 1004,  570,  421,
+     868,  106,  562,  414,  160,  499,  253,   85,  445,  203,  824,  309,  969,  743,  495,  295,
+      45,  734,  478,  304,  578, 1011,  857,    0,  589,  987,  353,  683,  482,  300,   76,  710,
+     174,  665,  989,  241,  823,  592, 1017,  789,  558,  880,  713,   26,  456,  222,  633,  894,
+     155,  983,  654,   96,  199,  443,  377,  764,  318,  134,  800,  939,   32,  619,  908,  370,
+     948,  301,  483,   60,  719,  342,   16,  671,  284,  140,  367,  598,  913,   97,  819,  405,
+     560,  266,  371,  926,  837,  711,   81,  634,  882,  451,  554,  184,  427,  816,  226,  550,
+       8,  769,  612,  867,  447,  914,  194,  411,  932,  521,  990,  251,  694,  524,  317,  706,
+     876,  772,  535,   38,  606,  244,  504,  945,  218,   46,  718,  279,  887,  118,  726,  454,
+     841,  208,  388,  144,  272,  642,  546,  839,  104,  725,   54,  426,  854,  178,  964,    7,
+     220,  115,  453,  795,  324,  973,  126,  308,  754,  608,  995,  361,  646,  510,  314, 1015,
+     105,  573,  929,  695,  996,   89,  741,  325,  475,  221,  809,  660,  120,  386,  618,  484,
+     363,  643, 1005,  180,  413,  738,  552,  849,  409,  492,  147,  780,   40,  952,  191,  664,
+     407,  752,  326,   27,  480,  383,  170,  978,  627,  901,  565,  306, 1009,  777,  258,  933,
+     842,  724,  278,  583,  898,   12,  673,  197,   71,  893,  245,  564,  437,  806,  595,   59,
+     860,  247,  533,  820,  603,  890,  783,  259,    2,  380,  157,  466,   35,  532,  712,   74,
+     163,  508,   51,  813,  143,  473,  356, 1021,  796,  322,  655,  940,  127,  339,  240,  925,
+     500,  117,  960,  175,  286,   68,  540,  459,  856,  709,  950,  649,  878,  192,  420,  588,
+     986,  410,  886,  336,  636,  934,  262,  596,  514,  727,   30,  385,  834,  688,  463,  759,
+     311,  701,  629,  444,  731,  972,  661,  131,  319,  551,   91,  273,  360,  801,  918,  320,
+     686,  237,  744,  544,  215,  787,  696,   94,  165,  432,  984,  211,  526,  903,    4,  166,
+    1001,  393,   33,  844,  345,  219,  390,  746, 1022,  216,  828,  730,  485,  121,  630,   25,
+     488,   80,  944,  122,  448,   41,  399,  956,  872,  287,  582,  774,  107,  298,  632,  549,
+     831,  232,  522,  922,   87,  585,  909,   29,  501,  614,  429,   47,  993,  545,  261,  786,
+     874,  600,  365,  658,  991,  826,  566,  223,  486,  814,   78,  681,  417,  976,  750,  359,
+      79,  610,  766,  159,  685,  467,  792,  289,  852,  162,  346,  885,  653,  198,  947,  394,
+     303,  187,  840,  516,  292,  146,  343,  742,   17,  641,  329,  919,  249,  498,  188,  879,
+     465,  951,  296,  375, 1002,  205,  108,  416,  659,  962,  751,  129,  310,  449,  698,   99,
+    1013,  715,   20,  230,  693,  917,  623,  866,  406, 1010,  176,  541,  850,   58,  663,  283,
+     142,  682,   52,  513,  617,  859,  716,  553,  235,   42,  481,  579,  846,   13,  810,  572,
+     479,  400,  907,  794,  431,   57,  497,  119,  260,  587,  785,  372,  133,  758,  569, 1012,
+     775,  398,  891,  798,  254,    9,  337,  985,  807,  376,  915,  181,  679,  931,  347,  141,
+     651,  264,   95,  594,  333,  999,  214,  733,  941,  458,   44,  692,  971,  434,  316,   15,
+     494,  234,  590,  151,  450,  905,  505,  139,  611,   92,  714,  274,  404,  518,  227,  776,
+     864,  525,  977,  158,  770,  530,  858,  369,  676,  164,  895,  281,  512,  202,  847,  638,
+     930,  116,  745,  968,  358,  637,  778,  276,  439,  875,  529, 1006,   67,  620,  967,   56,
+     183,  737,  440,  668,  269,  101,  615,    5,  293,  537,  829,  113,  650,  943,   84,  362,
+     808,  277,  536,   39,  704,  200,   66,  936,  670,  204,  332,  793,  153,  728,  428,  321,
+     910,  352,   28,  848,  395,  954,  461,  811,  980,  423,  607,  351,  760,  415,  581,  177,
+     468,  680,  392,  853,  299, 1018,  543,  397,  815,   23,  601,  469,  899,  257,  838,  561,
+     128,  628,  942,  206,  577,  717,  148,  238,  748,   83,  207, 1016,   22,  267,  833,  729,
+    1000,   75,  924,  169,  605,  436,  755,  136,  312,  970,  702,  109,  368,  527,    3,  700,
+     460,  282,  517,  797,   62,  323,  888,  548,  374,  684,  861,  491,  677,  906,  132,  531,
+     327,  239,  648,  511,  830,   86,  250,  897,  563,  446,  189,  773,  959,  656,  209, 1023,
+     827,   70,  674,  381,  988,  493,  662,   34,  938,  271,  568,  161,  341,  441,  626,   48,
+     884,  455,  763,    1,  357,  955,  723,  647,   64,  825,  265,  574,   77,  305,  757,  384,
+     597,  957,  190,  735,  124,  255,  804,  167,  471,  781,   50,  963,  802,  229,  981,  378,
+     689,  138,  974,  280,  599,  490,  195,  330,  509, 1008,  373,  902,  433,  855,  507,  145,
+     252,  771,  334,  452,  911,  584,  401,  998,  625,  315,  424,  699,  103,  575,  740,  193,
+     843,  547,  403,  865,  111,  788,  425,  877,  137,  667,   19,  708,  172,  613,   37,  920
+};
+
+void dither_tile_init(DitherTile *tile, DitherMode mode, float level, int num_colors) {
+    int rank[TILE_PIXELS];
+    int levels = TILE_PIXELS;
+
+    if (mode == DITHER_BLUE_NOISE) {
+        for (int i = 0; i < TILE_PIXELS; i++) {
+            rank[i] = blue_noise_rank[i];
+        }
+    }
+    else {
+        int size = (mode == DITHER_BAYER4) ? 4 : 8;
+        levels = size * size;
+        for (int i = 0; i < TILE_PIXELS; i++) {
+            rank[i] = bayer_rank(i % DITHER_TILE, i / DITHER_TILE, size);
+        }
+    }
+
+    //a threshold in (-0.5, 0.5) times roughly one palette step
+    double spread = level * 255.0 / cbrt((num_colors > 1) ? num_colors : 2);
+    memset(tile, 0, sizeof(DitherTile));
+    for (int i = 0; i < TILE_PIXELS; i++) {
+        int offset = (int)lround((((rank[i] + 0.5) / levels) - 0.5) * spread);
+        for (int c = 0; c < 3; c++) {
+            tile->add[(i * 4) + c] = (unsigned char)((offset > 0) ? offset : 0);
+            tile->sub[(i * 4) + c] = (unsigned char)((offset < 0) ? -offset : 0);
+        }
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Ordered dithering
+ *--------------------------------------
+*/
+
+#ifndef FBIN_DITHER_H
+#define FBIN_DITHER_H
+
+//the threshold pattern repeats every DITHER_TILE pixels in both directions
+#define DITHER_TILE 32
+
+typedef enum {
+    DITHER_DIFFUSION,   //libimagequant's error diffusion
+    DITHER_BAYER4,
+    DITHER_BAYER8,
+    DITHER_BLUE_NOISE
+} DitherMode;
+
+//per-pixel offsets ready for saturating byte math: a pixel at (x, y) becomes
+//pixel + add - sub, with both laid out as rgba (alpha untouched)
+typedef struct {
+    unsigned char add[DITHER_TILE * DITHER_TILE * 4];
+    unsigned char sub[DITHER_TILE * DITHER_TILE * 4];
+} DitherTile;
+
+int parse_dither_mode(const char *str, DitherMode *mode);
+//builds the offsets for an ordered mode; the spread follows the palette spacing
+//(255 / cbrt(num_colors)), scaled by the -d level
+void dither_tile_init(DitherTile *tile, DitherMode mode, float level, int num_colors);
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: v2 frame records
+ *--------------------------------------
+*/
+
+#include "encode.h"
+
+#include <string.h>
+
+//a gap this short costs less to copy than the 2 bytes of a new skip/copy pair
+#define DELTA_MAX_GAP 2
+#define DELTA_MAX_RUN 255
+
+static void put_u16(unsigned char *dst, unsigned int value) {
+    dst[0] = (unsigned char)(value & 0xFF);
+    dst[1] = (unsigned char)((value >> 8) & 0xFF);
+}
+
+static void put_u24(unsigned char *dst, unsigned long value) {
+    dst[0] = (unsigned char)(value & 0xFF);
+    dst[1] = (unsigned char)((value >> 8) & 0xFF);
+    dst[2] = (unsigned char)((value >> 16) & 0xFF);
+}
+
+static void put_u32(unsigned char *dst, unsigned long value) {
+    put_u24(dst, value);
+    dst[3] = (unsigned char)((value >> 24) & 0xFF);
+}
+
+size_t record_capacity(int num_colors, size_t pixel_count) {
+    return RECORD_HEADER_SIZE + (2 * (size_t)num_colors) + pixel_count;
+}
+
+//skip/copy runs from previous to current, returns 1 (and gives up) once the body reaches limit
+static int encode_delta(const unsigned char *previous, const unsigned char *current, size_t pixel_count,
+                        unsigned char *body, size_t limit, size_t *body_size) {
+    size_t size = 0;
+    size_t pos = 0;
+
+    for (;;) {
+        size_t skip = 0;
+        while ((pos + skip < pixel_count) && (previous[pos + skip] == current[pos + skip])) {
+            skip++;
+        }
+        pos += skip;
+        if (pos == pixel_count) {
+            //the rest is unchanged, the body just ends
+            *body_size = size;
+            return 0;
+        }
+
+        //changed pixels, bridging short unchanged gaps
+        size_t copy = 1;
+        while ((pos + copy < pixel_count) && (copy < DELTA_MAX_RUN)) {
+            if (previous[pos + copy] != current[pos + copy]) {
+                copy++;
+                continue;
+            }
+            size_t gap = 1;
+            while ((gap <= DELTA_MAX_GAP) && (pos + copy + gap < pixel_count) &&
+                   (previous[pos + copy + gap] == current[pos + copy + gap])) {
+                gap++;
+            }
+            if ((gap > DELTA_MAX_GAP) || (pos + copy + gap == pixel_count) || (copy + gap >= DELTA_MAX_RUN)) {
+                break;
+            }
+            copy += gap;
+        }
+
+        //long skips take (255, 0) pairs first
+        size_t pairs = skip / DELTA_MAX_RUN;
+        if (size + (2 * (pairs + 1)) + copy >= limit) {
+            return 1;
+        }
+        for (size_t i = 0; i < pairs; i++) {
+            body[size++] = DELTA_MAX_RUN;
+            body[size++] = 0;
+        }
+        body[size++] = (unsigned char)(skip % DELTA_MAX_RUN);
+        body[size++] = (unsigned char)copy;
+        memcpy(body + size, current + pos, copy);
+        size += copy;
+        pos += copy;
+    }
+}
+
+size_t encode_indices(const ProcessedFrame *frame, const ProcessedFrame *previous, size_t pixel_count,
+                      CompressMode compress, unsigned char *dst, unsigned char *scratch, int *flags) {
+    //raw indices are the size to beat, every encoding below stops once it can't
+    size_t best = pixel_count;
+    size_t size = 0;
+    *flags = 0;
+
+    //the runs only rebuild the indices, they hold under any palette
+    if (previous && previous->indexed_pixels &&
+        !encode_delta(previous->indexed_pixels, frame->indexed_pixels, pixel_count, dst, best, &size)) {
+        *flags = RECORD_DELTA;
+        best = size;
+    }
+    if (((compress == COMPRESS_RLE) || (compress == COMPRESS_BEST)) &&
+        !rle_compress(frame->indexed_pixels, pixel_count, scratch, best, &size)) {
+        memcpy(dst, scratch, size);
+        *flags = RECORD_RLE;
+        best = size;
+    }
+    if (((compress == COMPRESS_LZ) || (compress == COMPRESS_BEST)) &&
+        !lz_compress(frame->indexed_pixels, pixel_count, scratch, best, &size)) {
+        memcpy(dst, scratch, size);
+        *flags = RECORD_LZ;
+        best = size;
+    }
+
+    if (*flags == 0) {
+        memcpy(dst, frame->indexed_pixels, pixel_count);
+    }
+    return best;
+}
+
+size_t encode_record_head(PaletteDictionary *dict, const unsigned char *packed, int num_colors,
+                          int flags, size_t indices_size, unsigned char *head) {
+    size_t palette_size = 2 * (size_t)num_colors;
+    unsigned char *part = head + RECORD_HEADER_SIZE;
+    size_t part_size = 0;
+
+    //the player only sees the packed palette, so that is what has to match
+    int entry = -1;
+    for (int i = 0; i < dict->filled; i++) {
+        if (memcmp(packed, dict->dictionary[i], palette_size) == 0) {
+            entry = i;
+            break;
+        }
+    }
+
+    if (dict->has_previous && (memcmp(packed, dict->previous, palette_size) == 0)) {
+        flags |= RECORD_PALETTE_KEPT;
+        dict->kept++;
+    }
+    else if (entry >= 0) {
+        flags |= RECORD_PALETTE_STORED;
+        part[part_size++] = (unsigned char)entry;
+        dict->stored++;
+    }
+    else {
+        memcpy(part, packed, palette_size);
+        part_size = palette_size;
+        dict->inlined++;
+        //the player stores it the same way
+        if (dict->entries > 0) {
+            memcpy(dict->dictionary[dict->next], packed, palette_size);
+            dict->next = (dict->next + 1) % dict->entries;
+            if (dict->filled < dict->entries) {
+                dict->filled++;
+            }
+        }
+    }
+    memcpy(dict->previous, packed, palette_size);
+    dict->has_previous = 1;
+
+    head[0] = (unsigned char)flags;
+    put_u24(head + 1, (unsigned long)(part_size + indices_size));
+    return RECORD_HEADER_SIZE + part_size;
+}
+
+void format_header(unsigned char *header, int width, int height, int num_colors, int dictionary_entries,
+                   long long frames) {
+    memcpy(header, "FBIN", 4);
+    header[4] = 2;
+    header[5] = (unsigned char)dictionary_entries;
+    put_u16(header + 6, (unsigned int)width);
+    put_u16(header + 8, (unsigned int)height);
+    put_u16(header + 10, (unsigned int)num_colors);
+    put_u32(header + 12, (unsigned long)frames);
+}
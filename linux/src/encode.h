@@ -0,0 +1,72 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: v2 frame records
+ *--------------------------------------
+*/
+
+#ifndef FBIN_ENCODE_H
+#define FBIN_ENCODE_H
+
+#include <stddef.h>
+
+#include "compress.h"
+#include "quantize.h"
+
+//v2 output, all values little-endian and byte aligned for a cheap eZ80 decoder:
+//  header (FORMAT_HEADER_SIZE bytes): "FBIN", version (2), palette dictionary entries (u8),
+//  width, height and num_colors (u16 each), frame count (u32)
+//  then one record per frame: flags (u8), body size (u24), body = palette part + indices part
+//    palette part:
+//      RECORD_PALETTE_KEPT:   nothing, the previous frame's palette stays
+//      RECORD_PALETTE_STORED: a dictionary entry (u8)
+//      otherwise:             the palette (2 * num_colors, rgb1555), which also replaces
+//                             dictionary entry 0, 1, 2, ... in turn (wrapping at the header's count)
+//    indices part:
+//      RECORD_DELTA:          runs against the previous frame's indices: [skip u8][copy u8]
+//                             [copy bytes], repeated. stopping early leaves the rest unchanged
+//      RECORD_RLE:            the indices, rle compressed (see compress.h)
+//      RECORD_LZ:             the indices, lz compressed (see compress.h)
+//      otherwise:             the indices (width * height)
+#define FORMAT_HEADER_SIZE 16
+#define RECORD_HEADER_SIZE 4
+#define RECORD_DELTA 0x01
+#define RECORD_PALETTE_KEPT 0x02
+#define RECORD_PALETTE_STORED 0x04
+#define RECORD_RLE 0x08
+#define RECORD_LZ 0x10
+#define RECORD_MAX_BODY ((1 << 24) - 1)
+//16 entries are 8 KB of the player's ram at 256 colors
+#define PALETTE_DICTIONARY_MAX 16
+#define PALETTE_DICTIONARY_DEFAULT 8
+
+//the writer's copy of the palettes the player holds, so each record can point at one
+typedef struct {
+    int entries;                //dictionary size, 0 = only the previous palette is kept
+    int filled;
+    int next;                   //entry the next inline palette replaces
+    int has_previous;
+    unsigned char previous[2 * 256];
+    unsigned char dictionary[PALETTE_DICTIONARY_MAX][2 * 256];
+    long long kept, stored, inlined;
+} PaletteDictionary;
+
+//largest record a frame can take (inline palette and raw indices)
+size_t record_capacity(int num_colors, size_t pixel_count);
+//encodes the indices part into 'dst' (at most pixel_count bytes) and returns its size, keeping
+//the smallest of the raw indices, runs against 'previous' (the frame written before it, NULL
+//if none) and the codecs 'compress' allows. 'scratch' holds pixel_count bytes unless compress is none
+size_t encode_indices(const ProcessedFrame *frame, const ProcessedFrame *previous, size_t pixel_count,
+                      CompressMode compress, unsigned char *dst, unsigned char *scratch, int *flags);
+//writes the record header and palette part in front of an indices part, returns their size
+//(at most RECORD_HEADER_SIZE + 2 * num_colors). 'packed' is the frame's packed palette (see
+//pack_palette). called in frame order, it updates 'dict'
+size_t encode_record_head(PaletteDictionary *dict, const unsigned char *packed, int num_colors,
+                          int flags, size_t indices_size, unsigned char *head);
+//fills in the file header
+void format_header(unsigned char *header, int width, int height, int num_colors, int dictionary_entries,
+                   long long frames);
+
+#endif
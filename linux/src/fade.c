@@ -0,0 +1,98 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Flat frame and fade detection
+ *--------------------------------------
+*/
+
+#include "fade.h"
+
+#include <math.h>
+#include <string.h>
+
+//below this average level (out of 3 * 255) a frame is too dark to tell a fade from a cut
+#define FADE_MIN_LEVEL 12.0f
+
+void frame_levels(const unsigned char *rgba, size_t pixel_count, unsigned char *luma, FrameLevels *levels) {
+    unsigned long long sum[3] = {0, 0, 0};
+    int low[3] = {255, 255, 255};
+    int high[3] = {0, 0, 0};
+
+    for (size_t i = 0; i < pixel_count; i++) {
+        const unsigned char *px = rgba + (i * 4);
+        for (int c = 0; c < 3; c++) {
+            sum[c] += px[c];
+            low[c] = (px[c] < low[c]) ? px[c] : low[c];
+            high[c] = (px[c] > high[c]) ? px[c] : high[c];
+        }
+        luma[i] = (unsigned char)(((px[0] * 77) + (px[1] * 150) + (px[2] * 29)) >> 8);
+    }
+
+    levels->spread = 0;
+    for (int c = 0; c < 3; c++) {
+        levels->mean[c] = (float)sum[c] / (float)pixel_count;
+        levels->spread = (high[c] - low[c] > levels->spread) ? (high[c] - low[c]) : levels->spread;
+    }
+    levels->gain = 1.0f;
+}
+
+int is_flat_frame(const FrameLevels *levels, int tolerance) {
+    return (levels->spread <= 2 * tolerance);
+}
+
+int fade_gain(const FrameLevels *anchor, const unsigned char *anchor_luma,
+              const FrameLevels *current, const unsigned char *luma, size_t pixel_count, int tolerance, float *gain) {
+    float anchor_level = anchor->mean[0] + anchor->mean[1] + anchor->mean[2];
+    if (anchor_level < FADE_MIN_LEVEL) {
+        return 0;
+    }
+    float g = (current->mean[0] + current->mean[1] + current->mean[2]) / anchor_level;
+
+    //the hue has to stay put, only the brightness moves
+    for (int c = 0; c < 3; c++) {
+        if (fabsf(current->mean[c] - (g * anchor->mean[c])) > (float)tolerance) {
+            return 0;
+        }
+    }
+
+    //and so does every pixel, anything moving in the frame breaks the fade (8.8 fixed point)
+    int scale = (int)lroundf(g * 256.0f);
+    int limit = tolerance * 256;
+    for (size_t i = 0; i < pixel_count; i++) {
+        int diff = ((int)luma[i] * 256) - (scale * anchor_luma[i]);
+        if ((diff > limit) || (diff < -limit)) {
+            return 0;
+        }
+    }
+    *gain = g;
+    return 1;
+}
+
+void flat_frame(const FrameLevels *levels, size_t pixel_count, ProcessedFrame *frame) {
+    memset(&frame->palette, 0, sizeof(liq_palette));
+    frame->palette.count = 1;
+    frame->palette.entries[0] = (liq_color){
+        (unsigned char)lroundf(levels->mean[0]),
+        (unsigned char)lroundf(levels->mean[1]),
+        (unsigned char)lroundf(levels->mean[2]),
+        255
+    };
+    memset(frame->indexed_pixels, 0, pixel_count);
+}
+
+void fade_frame(const ProcessedFrame *previous, const unsigned char *previous_indices, float gain,
+                size_t pixel_count, ProcessedFrame *frame) {
+    frame->palette = previous->palette;
+    for (unsigned int j = 0; j < frame->palette.count; j++) {
+        liq_color *entry = &frame->palette.entries[j];
+        long r = lroundf(entry->r * gain);
+        long g = lroundf(entry->g * gain);
+        long b = lroundf(entry->b * gain);
+        entry->r = (unsigned char)((r > 255) ? 255 : r);
+        entry->g = (unsigned char)((g > 255) ? 255 : g);
+        entry->b = (unsigned char)((b > 255) ? 255 : b);
+    }
+    memcpy(frame->indexed_pixels, previous_indices, pixel_count);
+}
@@ -0,0 +1,44 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Flat frame and fade detection
+ *--------------------------------------
+*/
+
+#ifndef FBIN_FADE_H
+#define FBIN_FADE_H
+
+#include <stddef.h>
+
+#include "quantize.h"
+
+//a fade may brighten the frame its indices came from by this much before a fresh search,
+//past that the darker frame's indices start to band
+#define FADE_MAX_GAIN 1.5f
+
+//what the classifier keeps of a frame, next to a luma plane of the same size
+typedef struct {
+    float mean[3];      //average r, g, b
+    int spread;         //largest max - min of the three channels
+    float gain;         //brightness relative to the searched frame whose indices this one uses
+} FrameLevels;
+
+//one pass over an rgba frame: fills in the levels and writes the frame's luma
+void frame_levels(const unsigned char *rgba, size_t pixel_count, unsigned char *luma, FrameLevels *levels);
+//a frame is flat when every channel stays within 'tolerance' of the middle of its range
+int is_flat_frame(const FrameLevels *levels, int tolerance);
+//a fade is the anchor (the searched frame whose indices it reuses) scaled by one gain: the
+//channel means and every pixel's luma have to stay within 'tolerance' of that. returns 1 with
+//the gain when it is one
+int fade_gain(const FrameLevels *anchor, const unsigned char *anchor_luma,
+              const FrameLevels *current, const unsigned char *luma, size_t pixel_count, int tolerance, float *gain);
+
+//a one color palette (the frame's mean) and all indices 0
+void flat_frame(const FrameLevels *levels, size_t pixel_count, ProcessedFrame *frame);
+//the previous frame's indices under its palette scaled by 'gain' (relative to the previous frame)
+void fade_frame(const ProcessedFrame *previous, const unsigned char *previous_indices, float gain,
+                size_t pixel_count, ProcessedFrame *frame);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: K-means palette refinement
+ *--------------------------------------
+*/
+
+#include "kmeans.h"
+#include "remap.h"
+#include "rgb555.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t error;
+    uint16_t key;
+} Outlier;
+
+static int compare_outliers(const void *a, const void *b) {
+    const Outlier *oa = a, *ob = b;
+    if (oa->error != ob->error) {
+        return (oa->error > ob->error) ? -1 : 1;
+    }
+    //same error: key order, so the result never depends on qsort
+    return (oa->key < ob->key) ? -1 : 1;
+}
+
+//moves the entries nobody picked onto the colors their nearest entry serves worst
+//(squared distance times count), returns how many were moved
+static int reseed_empty(const uint32_t *histogram, const uint16_t *keys, const unsigned char *nearest, int key_count,
+                        const uint64_t *weight, Outlier *outliers, liq_palette *palette) {
+    int outlier_count = 0;
+    for (int i = 0; i < key_count; i++) {
+        int key = keys[i];
+        const liq_color *entry = &palette->entries[nearest[i]];
+        int dr = RGB555_EXPAND(key >> 10) - entry->r;
+        int dg = RGB555_EXPAND((key >> 5) & 0x1F) - entry->g;
+        int db = RGB555_EXPAND(key & 0x1F) - entry->b;
+        uint64_t error = (uint64_t)((dr * dr) + (dg * dg) + (db * db)) * histogram[key];
+        if (error) {
+            outliers[outlier_count].error = error;
+            outliers[outlier_count].key = (uint16_t)key;
+            outlier_count++;
+        }
+    }
+    qsort(outliers, outlier_count, sizeof(Outlier), compare_outliers);
+
+    int moved = 0;
+    for (unsigned int j = 0; (j < palette->count) && (moved < outlier_count); j++) {
+        if (!weight[j]) {
+            int key = outliers[moved++].key;
+            palette->entries[j] = (liq_color){RGB555_EXPAND(key >> 10), RGB555_EXPAND((key >> 5) & 0x1F), RGB555_EXPAND(key & 0x1F), 255};
+        }
+    }
+    return moved;
+}
+
+int kmeans_refine(Arena *arena, const uint32_t *histogram, int rounds, liq_palette *palette) {
+    uint16_t *keys = arena_alloc(arena, RGB555_COLORS * sizeof(uint16_t));
+    unsigned char *nearest = arena_alloc(arena, RGB555_COLORS);
+    Outlier *outliers = arena_alloc(arena, RGB555_COLORS * sizeof(Outlier));
+    if (!keys || !nearest || !outliers) {
+        return 1;
+    }
+
+    //only the occupied keys take part, a frame rarely has more than a few thousand
+    int key_count = 0;
+    for (int key = 0; key < RGB555_COLORS; key++) {
+        if (histogram[key]) {
+            keys[key_count++] = (uint16_t)key;
+        }
+    }
+
+    for (int round = 0; round < rounds; round++) {
+        uint64_t sum[256][3];
+        uint64_t weight[256];
+        memset(sum, 0, sizeof(sum));
+        memset(weight, 0, sizeof(weight));
+
+        remap_nearest(palette, keys, key_count, nearest);
+        for (int i = 0; i < key_count; i++) {
+            int key = keys[i];
+            uint32_t count = histogram[key];
+            sum[nearest[i]][0] += (uint64_t)(key >> 10) * count;
+            sum[nearest[i]][1] += (uint64_t)((key >> 5) & 0x1F) * count;
+            sum[nearest[i]][2] += (uint64_t)(key & 0x1F) * count;
+            weight[nearest[i]] += count;
+        }
+
+        //entries nobody picked (a stale seed, duplicates) restart on the worst served colors
+        int moved = reseed_empty(histogram, keys, nearest, key_count, weight, outliers, palette);
+        for (unsigned int j = 0; j < palette->count; j++) {
+            if (!weight[j]) {
+                continue;
+            }
+            liq_color color = {
+                .r = RGB555_EXPAND((int)((sum[j][0] + (weight[j] / 2)) / weight[j])),
+                .g = RGB555_EXPAND((int)((sum[j][1] + (weight[j] / 2)) / weight[j])),
+                .b = RGB555_EXPAND((int)((sum[j][2] + (weight[j] / 2)) / weight[j])),
+                .a = 255
+            };
+            if (memcmp(&color, &palette->entries[j], sizeof(liq_color)) != 0) {
+                palette->entries[j] = color;
+                moved = 1;
+            }
+        }
+        if (!moved) {
+            break;
+        }
+    }
+    return 0;
+}
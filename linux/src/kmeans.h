@@ -0,0 +1,26 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: K-means palette refinement
+ *--------------------------------------
+*/
+
+#ifndef FBIN_KMEANS_H
+#define FBIN_KMEANS_H
+
+#include <stdint.h>
+
+#include "../include/libimagequant.h"
+#include "arena.h"
+
+//k-means over the RGB555_COLORS counts of a frame, in the 5-bit space the output keeps:
+//each round assigns every occupied color to its nearest entry (the simd table search)
+//and moves each entry to the weighted mean of its colors (entries without colors jump to
+//the worst served ones), until nothing moves or 'rounds' is reached. palette holds the
+//starting entries and receives the result
+//scratch memory comes from the arena. returns 0 on success, 1 when out of memory
+int kmeans_refine(Arena *arena, const uint32_t *histogram, int rounds, liq_palette *palette);
+
+#endif
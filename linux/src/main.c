@@ -8,6 +8,15 @@
 */
 
 #include "../include/libimagequant.h"
+#include "decode.h"
+#include "encode.h"
+#include "pipeline.h"
+#include "remap.h"
+#include "arena.h"
+//png frames are loaded into the worker thread's arena
+#define STBI_MALLOC(sz) arena_thread_malloc(sz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz) arena_thread_realloc(p, oldsz, newsz)
+#define STBI_FREE(p) arena_thread_free(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "../include/stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -21,17 +30,15 @@
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
-#include <sys/sysinfo.h>
 #include <unistd.h>
 
 #define MAX_PATH_LENGTH 260
-#define MEM_LIMIT_DENOM 4
-
-typedef struct {
-    unsigned char *indexed_pixels;
-    liq_palette palette;
-    int frame_number;
-} ProcessedFrame;
+#define WINDOW_PER_THREAD 4
+#define MIN_SEGMENT_FRAMES 24
+#define MAX_SHOT_FRAMES 96
+//frames at least this big are split over a few threads each with --frame-threads auto
+#define LARGE_FRAME_PIXELS (320 * 240)
+#define LARGE_FRAME_THREADS 4
 
 int get_total_frames(const char *frames_folder, const char *frame_name);
 void print_instructions(void);
@@ -49,8 +56,29 @@ int main(int argc, char *argv[]) {
     float framerate = 10.8;
     const char *quality_str = "0:100";
     float dither_level = 1.0;
+    DitherMode dither_mode = DITHER_DIFFUSION;
     int min_brightness = 4;
     int num_colors = 256;
+    DecoderType decoder_type = DECODER_PNG;
+    int decode_segments = 1;
+    WriteMode write_mode = WRITE_STREAM;
+    OutputFormat output_format = FORMAT_V1;
+    int palette_dictionary = -1;    //-1 = the v2 default
+    CompressMode compress = COMPRESS_NONE;
+    const char *appvar_prefix = NULL;
+    int appvar_size = APPVAR_MAX_SIZE;
+    int reuse_quality = 0;
+    int chain_frames = 12;
+    int warm_rounds = 0;
+    int fade_tolerance = 0;
+    int duplicate_tolerance = -1;   //-1 = off
+    int scene_cut = 0;
+    QuantizerType quantizer_type = QUANTIZER_LIQ;
+    HistogramInput histogram_input = HISTOGRAM_IMAGE;
+    double target_fps = 0.0;
+    double time_budget = 0.0;
+    int frame_threads = 1;      //0 = pick from the frame count and size
+    int palette_sample = 100;
 
     //Other variables
     const char *frames_folder = "frames";
@@ -146,6 +174,18 @@ int main(int argc, char *argv[]) {
                     print_instructions();
                     return 1;
                 }
+            } else if (strcmp(arg, "--dither-mode") == 0) {
+                if (i + 1 < argc) {
+                    if (parse_dither_mode(argv[i + 1], &dither_mode)) {
+                        printf("dither mode: diffusion, bayer4, bayer8 or bluenoise\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
             } else if ((strcmp(arg, "-p") == 0) || (strcmp(arg, "--palette") == 0)) {
                 if (i + 1 < argc) {
                     num_colors = atoi(argv[i + 1]);
@@ -155,6 +195,259 @@ int main(int argc, char *argv[]) {
                     print_instructions();
                     return 1;
                 }
+            } else if (strcmp(arg, "--decoder") == 0) {
+                if (i + 1 < argc) {
+                    if (parse_decoder_type(argv[i + 1], &decoder_type)) {
+                        printf("decoder: png, pipe or libav\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--decode-segments") == 0) {
+                if (i + 1 < argc) {
+                    decode_segments = atoi(argv[i + 1]);
+                    if (decode_segments < 1) {
+                        printf("decode segments: 1 or more\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--write-mode") == 0) {
+                if (i + 1 < argc) {
+                    if (parse_write_mode(argv[i + 1], &write_mode)) {
+                        printf("write mode: stream, direct, pwrite or mmap\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--format") == 0) {
+                if (i + 1 < argc) {
+                    if (parse_output_format(argv[i + 1], &output_format)) {
+                        printf("format: v1 or v2\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--palette-dict") == 0) {
+                if (i + 1 < argc) {
+                    palette_dictionary = atoi(argv[i + 1]);
+                    if ((palette_dictionary < 0) || (palette_dictionary > PALETTE_DICTIONARY_MAX)) {
+                        printf("palette dictionary: 0 - %d entries\n", PALETTE_DICTIONARY_MAX);
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--compress") == 0) {
+                if (i + 1 < argc) {
+                    if (parse_compress_mode(argv[i + 1], &compress)) {
+                        printf("compress: none, rle, lz or best\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--appvar") == 0) {
+                if (i + 1 < argc) {
+                    appvar_prefix = argv[i + 1];
+                    if (!appvar_valid_prefix(appvar_prefix)) {
+                        printf("appvar name: 1 - %d letters and digits, starting with a letter\n", APPVAR_PREFIX_LENGTH);
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--appvar-size") == 0) {
+                if (i + 1 < argc) {
+                    appvar_size = atoi(argv[i + 1]);
+                    if ((appvar_size < APPVAR_MIN_SIZE) || (appvar_size > APPVAR_MAX_SIZE)) {
+                        printf("appvar size: %d - %d bytes\n", APPVAR_MIN_SIZE, APPVAR_MAX_SIZE);
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--quantizer") == 0) {
+                if (i + 1 < argc) {
+                    if (parse_quantizer_type(argv[i + 1], &quantizer_type)) {
+                        printf("quantizer: liq, rgb555, octree or kmeans\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--histogram") == 0) {
+                if (i + 1 < argc) {
+                    if (parse_histogram_input(argv[i + 1], &histogram_input)) {
+                        printf("histogram: image or rgb555\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--palette-reuse") == 0) {
+                if (i + 1 < argc) {
+                    reuse_quality = atoi(argv[i + 1]);
+                    if ((reuse_quality < 1) || (reuse_quality > 100)) {
+                        printf("palette reuse quality: 1 - 100\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--warm-start") == 0) {
+                if (i + 1 < argc) {
+                    warm_rounds = atoi(argv[i + 1]);
+                    if ((warm_rounds < 1) || (warm_rounds > 100)) {
+                        printf("warm start rounds: 1 - 100\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--fades") == 0) {
+                if (i + 1 < argc) {
+                    fade_tolerance = atoi(argv[i + 1]);
+                    if ((fade_tolerance < 1) || (fade_tolerance > 64)) {
+                        printf("fade tolerance: 1 - 64\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--dedup") == 0) {
+                if (i + 1 < argc) {
+                    duplicate_tolerance = atoi(argv[i + 1]);
+                    if ((duplicate_tolerance < 0) || (duplicate_tolerance > 64)) {
+                        printf("dedup tolerance: 0 - 64\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--chain-length") == 0) {
+                if (i + 1 < argc) {
+                    chain_frames = atoi(argv[i + 1]);
+                    if (chain_frames < 1) {
+                        printf("chain length: 1 or more\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--scene-palettes") == 0) {
+                if (i + 1 < argc) {
+                    scene_cut = atoi(argv[i + 1]);
+                    if ((scene_cut < 1) || (scene_cut > 100)) {
+                        printf("scene cut: 1 - 100 (%% of the colors that change)\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--target-fps") == 0) {
+                if (i + 1 < argc) {
+                    target_fps = atof(argv[i + 1]);
+                    if (target_fps <= 0.0) {
+                        printf("target fps: more than 0\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--time-budget") == 0) {
+                if (i + 1 < argc) {
+                    if (parse_time_string(argv[i + 1], &time_budget) || (time_budget <= 0.0)) {
+                        printf("time budget: HH:MM:SS or seconds, more than 0\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--frame-threads") == 0) {
+                if (i + 1 < argc) {
+                    frame_threads = (strcmp(argv[i + 1], "auto") == 0) ? 0 : atoi(argv[i + 1]);
+                    if ((frame_threads < 1) && (strcmp(argv[i + 1], "auto") != 0)) {
+                        printf("frame threads: 1 or more, or auto\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
+            } else if (strcmp(arg, "--palette-sample") == 0) {
+                if (i + 1 < argc) {
+                    palette_sample = atoi(argv[i + 1]);
+                    if ((palette_sample < 1) || (palette_sample > 100)) {
+                        printf("palette sample: 1 - 100\n");
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    printf("missing argument after %s\n", arg);
+                    print_instructions();
+                    return 1;
+                }
             } else if ((strcmp(arg, "-v") == 0) || (strcmp(arg, "--version") == 0)) {
                 printf("\nFBin Linux\n");
                 printf("authored by WillDaBeast555\n\n");
@@ -186,8 +479,148 @@ int main(int argc, char *argv[]) {
             printf("qual_min >= 0 and qual_max <= 100\n");
             return 0;
         } 
+
+        if ((num_colors < 2) || (num_colors > 256)) {
+            printf("num_colors: 2 - 256\n");
+            return 1;
+        }
+
+        if ((histogram_input != HISTOGRAM_IMAGE) && (quantizer_type != QUANTIZER_LIQ)) {
+            printf("--histogram needs --quantizer liq\n");
+            return 1;
+        }
+
+        if ((scene_cut > 0) && (quantizer_type != QUANTIZER_LIQ)) {
+            printf("--scene-palettes needs --quantizer liq\n");
+            return 1;
+        }
+
+        if ((scene_cut > 0) && ((reuse_quality > 0) || (warm_rounds > 0) || (fade_tolerance > 0) || (duplicate_tolerance >= 0))) {
+            printf("--scene-palettes can't be combined with --palette-reuse, --warm-start, --fades or --dedup\n");
+            return 1;
+        }
+
+        if ((reuse_quality > 0) && (quantizer_type != QUANTIZER_LIQ)) {
+            printf("--palette-reuse needs --quantizer liq\n");
+            return 1;
+        }
+
+        if (((target_fps > 0.0) || (time_budget > 0.0)) && (quantizer_type != QUANTIZER_LIQ)) {
+            printf("--target-fps and --time-budget need --quantizer liq\n");
+            return 1;
+        }
+
+        if ((target_fps > 0.0) && (time_budget > 0.0)) {
+            printf("--target-fps and --time-budget can't be combined\n");
+            return 1;
+        }
+
+        if ((decode_segments > 1) && (decoder_type != DECODER_LIBAV)) {
+            printf("--decode-segments needs --decoder libav\n");
+            return 1;
+        }
+
+        //v2 records have a variable size, so they can't go to fixed offsets
+        if ((output_format == FORMAT_V2) && (write_mode != WRITE_STREAM) && (write_mode != WRITE_DIRECT)) {
+            printf("--format v2 needs --write-mode stream or direct\n");
+            return 1;
+        }
+
+        if ((output_format == FORMAT_V2) && (record_capacity(num_colors, (size_t)scale_x * scale_y) - RECORD_HEADER_SIZE > RECORD_MAX_BODY)) {
+            printf("--format v2 frames are limited to %d bytes, lower the scale\n", RECORD_MAX_BODY);
+            return 1;
+        }
+
+        if ((palette_dictionary >= 0) && (output_format != FORMAT_V2)) {
+            printf("--palette-dict needs --format v2\n");
+            return 1;
+        }
+        if (palette_dictionary < 0) {
+            palette_dictionary = PALETTE_DICTIONARY_DEFAULT;
+        }
+
+        if ((compress != COMPRESS_NONE) && (output_format != FORMAT_V2)) {
+            printf("--compress needs --format v2\n");
+            return 1;
+        }
+
+        if (appvar_prefix && (write_mode != WRITE_STREAM)) {
+            printf("--appvar needs --write-mode stream\n");
+            return 1;
+        }
+
+        //frames are never split, so the largest one (after the v2 header) has to fit a part
+        if (appvar_prefix) {
+            size_t largest = (output_format == FORMAT_V2) ?
+                FORMAT_HEADER_SIZE + record_capacity(num_colors, (size_t)scale_x * scale_y) :
+                ((size_t)num_colors * 2) + ((size_t)scale_x * scale_y);
+            if (largest > (size_t)appvar_size) {
+                printf("a %zu byte frame doesn't fit a %d byte appvar, lower the scale\n", largest, appvar_size);
+                return 1;
+            }
+        }
     }
-    {   //convert the video into resized frames
+    int num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int window;
+    {   //initialize parallel processing / window sizing
+        //set the number of OpenMP threads
+        omp_set_num_threads(num_processors);
+        printf("using %d threads\n", omp_get_max_threads());
+        if ((dither_level == 0.0f) || (quantizer_type != QUANTIZER_LIQ) || (dither_mode != DITHER_DIFFUSION)) {
+            printf("remapping with the %s rgb555 table kernel\n", remap_kernel_name());
+        }
+
+        //frames in flight only have to cover the threads working on them, so the
+        //reorder window grows with the thread count instead of the free memory
+        size_t approx_frame_size = (scale_x * scale_y) + sizeof(liq_palette);
+        //fades keep each frame's luma next to it, --dedup its pixels
+        if (fade_tolerance > 0) {
+            approx_frame_size += (size_t)scale_x * scale_y;
+        }
+        if (duplicate_tolerance >= 0) {
+            approx_frame_size += (size_t)scale_x * scale_y * 4;
+        }
+        //v2 keeps each frame's encoded indices, and a scratch copy to compress into
+        if (output_format == FORMAT_V2) {
+            approx_frame_size += (size_t)scale_x * scale_y * ((compress != COMPRESS_NONE) ? 2 : 1);
+        }
+        window = WINDOW_PER_THREAD * num_processors;
+
+        //every decoder needs a segment long enough to be worth the seek
+        if (window < decode_segments * MIN_SEGMENT_FRAMES) {
+            window = decode_segments * MIN_SEGMENT_FRAMES;
+        }
+        //chains run one frame at a time, so every thread needs a chain of its own in the window
+        if (((reuse_quality > 0) || (warm_rounds > 0) || (fade_tolerance > 0) || (duplicate_tolerance >= 0)) &&
+            (window < chain_frames * num_processors)) {
+            window = chain_frames * num_processors;
+        }
+        //a shot is held until it is complete, room for two lets the next one fill meanwhile
+        if ((scene_cut > 0) && (window < 2 * MAX_SHOT_FRAMES)) {
+            window = 2 * MAX_SHOT_FRAMES;
+        }
+
+        //print window information
+        printf("frame window set to %d\n", window);
+        printf("(using up to ~%zu KB of mem for frames in flight)\n", (approx_frame_size * window) / 1024);
+    }
+
+    DecodeOptions decode_opts = {
+        .input_filename = input_filename,
+        .start_string = start_string,
+        .stop_string = stop_string,
+        .scale_x = scale_x,
+        .scale_y = scale_y,
+        .framerate = framerate,
+        .min_brightness = min_brightness,
+        .segments = decode_segments,
+        //each decoder gets its share of the window, so all of them can run at once
+        .segment_frames = window / decode_segments
+    };
+    FrameStream frame_stream = {0};
+    int total_frames = 0;
+
+    if (decoder_type == DECODER_PNG) {   //convert the video into resized frames
         {//set up folder
             struct stat st = {0};
             if (stat(frames_folder, &st) == -1) {
@@ -202,81 +635,72 @@ int main(int argc, char *argv[]) {
             }
         }
         {//ffmpeg
-            char ffmpeg_command[512];
-            if (stop_string != NULL) {
-                snprintf(ffmpeg_command, sizeof(ffmpeg_command),
-                        "ffmpeg -i %s -ss %s -to %s -vf \"scale=%d:%d, lutrgb=r='if(gte(val,0.5),val,val*%d)':g='if(gte(val,0.5),val,val*%d)':b='if(gte(val,0.5),val,val*%d)'\" -r %1f %s/%s_%%d.png",
-                        input_filename, start_string, stop_string, scale_x, scale_y, min_brightness, min_brightness, min_brightness, framerate, frames_folder, frame_name);
-            }
-            else {
-                snprintf(ffmpeg_command, sizeof(ffmpeg_command),
-                        "ffmpeg -i %s -ss %s -vf \"scale=%d:%d, lutrgb=r='if(gte(val,0.5),val,val*%d)':g='if(gte(val,0.5),val,val*%d)':b='if(gte(val,0.5),val,val*%d)'\" -r %1f %s/%s_%%d.png",
-                        input_filename, start_string, scale_x, scale_y, min_brightness, min_brightness, min_brightness, framerate, frames_folder, frame_name);
-            }
-
-            int ffmpeg_err = system(ffmpeg_command);
-            if (!ffmpeg_err) {
-                printf("ffmpeg command executed successfully\n");
-            }
-            else {
-                perror("ffmpeg command failed");
-                fprintf(stderr, "; error code: %d\n", ffmpeg_err);
+            if (extract_png_frames(&decode_opts, frames_folder, frame_name)) {
                 return 1;
             }
         }
+        total_frames = get_total_frames(frames_folder, frame_name);
+    }
+    else {   //stream the resized frames straight from ffmpeg / libav
+        //decoder threads that find no room in the pipeline sleep, so they share the cores with quantizing
+        if (frame_stream_open(&frame_stream, decoder_type, &decode_opts, num_processors)) {
+            return 1;
+        }
     }
     {   //quantize each frame into 256 colors each and write file
-        FILE *file = fopen(output_filename, "wb");
-        int total_frames = get_total_frames(frames_folder, frame_name);
-        int batch_size;
-        int processing_errors = 0;
-        int current_frame = 0;
+        FrameOutput output;
+        PipelineStats stats;
+        int pipeline_err;
         double start_time, end_time;
         double elapsed_time;
 
         {   //initialize the file to write
             printf("initializing frame processing\n");
-            if (file == NULL) {
-                perror("error opening output file\n");
-                return 1;
+            long long expected_frames = (decoder_type == DECODER_PNG) ? total_frames : frame_stream_expected_frames(&frame_stream, &decode_opts);
+            //a time budget is a frame rate once the frame count is known
+            if (time_budget > 0.0) {
+                if (expected_frames <= 0) {
+                    printf("--time-budget needs a known frame count, set -to\n");
+                    return 1;
+                }
+                target_fps = expected_frames / time_budget;
+            }
+            if (target_fps > 0.0) {
+                printf("adapting the quantization speed to %.1f frames per second\n", target_fps);
             }
-            fclose(file); // Close file to wipe it
-            printf("cleared '%s'\n", output_filename);
 
-            file = fopen(output_filename, "ab");
-            if (file == NULL) {
-                perror("error opening output file for appending\n");
+            //short clips can't keep every thread busy with whole frames, and big frames
+            //take long enough on one thread to hold up the writer
+            if (frame_threads == 0) {
+                frame_threads = 1;
+                if ((expected_frames > 0) && (expected_frames < num_processors)) {
+                    frame_threads = num_processors / expected_frames;
+                } else if ((long long)scale_x * scale_y >= LARGE_FRAME_PIXELS) {
+                    frame_threads = (num_processors < LARGE_FRAME_THREADS) ? num_processors : LARGE_FRAME_THREADS;
+                }
+            }
+            if (frame_threads > num_processors) {
+                frame_threads = num_processors;
+            }
+            if (frame_threads > 1) {
+                printf("splitting each frame over %d threads\n", frame_threads);
+            }
+            OutputOptions output_opts = {
+                .mode = write_mode,
+                .format = output_format,
+                .width = scale_x,
+                .height = scale_y,
+                .num_colors = num_colors,
+                .expected_frames = expected_frames,
+                .palette_dictionary = (output_format == FORMAT_V2) ? palette_dictionary : 0,
+                .compress = compress,
+                .appvar_prefix = appvar_prefix,
+                .appvar_size = (size_t)appvar_size
+            };
+            if (output_open(&output, output_filename, &output_opts)) {
                 return 1;
             }
-            printf("opened '%s' for appending\n", output_filename);
         }  
-        {   //initialize parallel processing / batch sizing
-            //get the system information for batch sizing
-            int num_processors = sysconf(_SC_NPROCESSORS_ONLN);
-
-            //set the number of OpenMP threads
-            omp_set_num_threads(num_processors);
-            printf("using %d threads\n", omp_get_max_threads());
-
-            //determine the batch size based on available memory
-            struct sysinfo memInfo;
-            sysinfo(&memInfo);
-            unsigned long long totalPhysMem = memInfo.totalram;
-            totalPhysMem *= memInfo.mem_unit;
-
-            unsigned long long mem_limit = totalPhysMem / MEM_LIMIT_DENOM;
-
-            size_t approx_frame_size = (scale_x * scale_y) + sizeof(liq_palette);
-            batch_size = (int)(mem_limit / approx_frame_size);
-            
-            //ensure batch size is at least 10 frames
-            batch_size = (batch_size < 10) ? 10 : batch_size;
-            batch_size = (batch_size > total_frames) ? total_frames : batch_size;
-
-            //print batch information
-            printf("batch size set to %d\n", batch_size);
-            printf("(using ~%zu MB of mem per batch)\n", (approx_frame_size * batch_size) / (1024 * 1024));
-        }
         {   //disable cursor
             hide_cursor();
         }
@@ -285,147 +709,102 @@ int main(int argc, char *argv[]) {
         
         start_time = omp_get_wtime();
 
-        while (current_frame < total_frames) {//(main loop) process frames
-            //allocate memory for current batch of processed frames
-            int frames_in_batch = (current_frame + batch_size <= total_frames) ? batch_size : (total_frames - current_frame);
-            printf("frames in batch: %d\n\n", frames_in_batch);
-
-            ProcessedFrame *processed_frames = (ProcessedFrame *)malloc(frames_in_batch * sizeof(ProcessedFrame));
-            if (!processed_frames) {
-                printf("failed to allocate memory for processes frames");
-                return 1;
-            }
-
-            //initialize the processed frames array for the current batch
-            for (int i = 0; i < frames_in_batch; i++) {
-                processed_frames[i].indexed_pixels = NULL;
-                processed_frames[i].frame_number = current_frame + i + 1;
-            }
-
-            //atomic counter for completed frames
-            int completed_frames = 0;
-
-            //process frames in this batch in parallel
-            #pragma omp parallel for schedule(dynamic)
-            for (int i = 0; i < frames_in_batch; i++) {
-                int frame_num = current_frame + i + 1;
-                char filename[MAX_PATH_LENGTH];
-
-                sprintf(filename, "%s/%s_%d.png", frames_folder, frame_name, frame_num);
-
-                //load the image
-                int width, height, channels;
-                unsigned char *pixels = stbi_load(filename, &width, &height, &channels, 4);
-                if (!pixels) {
-                    fprintf(stderr, "failed to load image '%s'\n", filename);
-                    processing_errors++;
-                    continue;
-                }
-
-                //create attributes
-                liq_attr *attr = liq_attr_create();
-                liq_set_max_colors(attr, num_colors);
-                liq_set_quality(attr, qual_min, qual_max);
-
-                //create image
-                liq_image *image = liq_image_create_rgba(attr, pixels, scale_x, scale_y, 0);
-
-                //quantize!
-                liq_result *result;
-                if (liq_image_quantize(image, attr, &result) != LIQ_OK) {
-                    #pragma omp critical
-                    {
-                        fprintf(stderr, "quantization failed for frame %d\n", frame_num);
-                        processing_errors++;
-                    }
-                    free(pixels);
-                    liq_image_destroy(image);
-                    liq_attr_destroy(attr);
-                    continue;
-                }
-                liq_set_dithering_level(result, dither_level);
-
-                //remap pixels to palette
-                processed_frames[i].indexed_pixels = malloc(scale_x * scale_y);
-                if (!processed_frames[i].indexed_pixels) {
-                    #pragma omp critical
-                    {
-                        fprintf(stderr, "memory allocation failed for indexed pixels in frame %d\n", frame_num);
-                        processing_errors++;
-                    }
-                    free(pixels);
-                    liq_result_destroy(result);
-                    liq_image_destroy(image);
-                    liq_attr_destroy(attr);
-                    continue;
-                }
-
-                liq_write_remapped_image(result, image, processed_frames[i].indexed_pixels, scale_x * scale_y);
-
-                //copy palette
-                const liq_palette *result_palette = liq_get_palette(result);
-                memcpy(&processed_frames[i].palette, result_palette, sizeof(liq_palette));
-
-                //clean up
-                liq_result_destroy(result);
-                liq_image_destroy(image);
-                liq_attr_destroy(attr);
-                free(pixels);
-
-                //update progress for each completed frame
-                #pragma omp critical
-                {
-                    completed_frames++;
-                    if ((completed_frames % 25 == 0) || (completed_frames == frames_in_batch)) {
-                        float overall_progress = (float)(current_frame + completed_frames) / total_frames;
-                        // Move cursor to beginning of line, clear the line, and print the progress
-                        printf("\r\033[K");  // \r moves cursor to start of line, \033[K clears to end of line
-                        printf("processing: %d/%d frames (%.1f%%)", 
-                            current_frame + completed_frames, 
-                            total_frames,
-                            overall_progress * 100);
-                        fflush(stdout);
-                    }
-                }
-            }
-
-            //write current batch of processed frames in order
-            for (int i = 0; i < frames_in_batch; i++) {
-                if (processed_frames[i].indexed_pixels) {
-                    //write palette
-                    for (int j = 0; j < num_colors; j++) {
-                        liq_color rgba_color = processed_frames[i].palette.entries[j];
-
-                        uint16_t rgb1555_color = 0;
-                        rgb1555_color = (((rgba_color.r >> 3) & 0x1F) << 10) |
-                                        (((rgba_color.g >> 3) & 0x1F) << 5)  |
-                                        (((rgba_color.b >> 3) & 0x1F) << 0);
-                        fwrite(&rgb1555_color, sizeof(rgb1555_color), 1, file);
-                    }
-
-                    //write indexed pixels
-                    fwrite(processed_frames[i].indexed_pixels, 1, scale_x * scale_y, file);
-
-                    //free memory
-                    free(processed_frames[i].indexed_pixels);
-                }
-            }
-
-            //free the processed frames array for this batch
-            free(processed_frames);
-
-            //move to next batch
-            current_frame += frames_in_batch;
+        {   //(main loop) decode, quantize and write frames concurrently
+            PipelineConfig pipeline = {
+                .decoder_type = decoder_type,
+                .stream = &frame_stream,
+                .frames_folder = frames_folder,
+                .frame_name = frame_name,
+                .png_frames = total_frames,
+                .quant = {
+                    .type = quantizer_type,
+                    .histogram = histogram_input,
+                    .scale_x = scale_x,
+                    .scale_y = scale_y,
+                    .num_colors = num_colors,
+                    .qual_min = qual_min,
+                    .qual_max = qual_max,
+                    .dither_level = dither_level,
+                    .dither_mode = dither_mode,
+                    .reuse_quality = reuse_quality,
+                    .warm_rounds = warm_rounds,
+                    .frame_threads = frame_threads,
+                    .palette_sample = palette_sample
+                },
+                .output = &output,
+                //the decode and write threads mostly wait on the workers
+                .workers = (num_processors / frame_threads > 0) ? (num_processors / frame_threads) : 1,
+                .window = window,
+                .chain_frames = chain_frames,
+                .scene_cut = scene_cut,
+                .shot_frames = MAX_SHOT_FRAMES,
+                .target_fps = target_fps,
+                .fade_tolerance = fade_tolerance,
+                .duplicates = (duplicate_tolerance >= 0),
+                .duplicate_tolerance = duplicate_tolerance
+            };
+            pipeline_err = run_pipeline(&pipeline, &stats);
         }
         
         {   //get elapsed time
             end_time = omp_get_wtime();
             elapsed_time = end_time - start_time;
             printf("\nprocessed in %lf seconds\n", elapsed_time);
+            if (stats.first_write_time >= 0.0) {
+                printf("first frame written after %lf seconds\n", stats.first_write_time);
+            }
+            if (stats.shots > 0) {
+                printf("%lld frames shared %lld shot palettes\n", stats.frames_written, stats.shots);
+            }
+            if (stats.palettes_reused > 0) {
+                printf("reused the previous palette for %lld of %lld frames\n", stats.palettes_reused, stats.frames_written);
+            }
+            if (stats.duplicate_frames > 0) {
+                printf("deduplicated %lld of %lld frames\n", stats.duplicate_frames, stats.frames_written);
+            }
+            if ((stats.flat_frames > 0) || (stats.fade_frames > 0)) {
+                printf("skipped the quantizer for %lld flat frames and %lld fade frames\n", stats.flat_frames, stats.fade_frames);
+            }
+            if (stats.palettes_refined > 0) {
+                printf("warm-started the palette of %lld of %lld frames\n", stats.palettes_refined, stats.frames_written);
+            }
+            if ((output_format == FORMAT_V2) && (output.records > 0)) {
+                //against v1's palette + indices per frame
+                double v1_bytes = (double)output.records * (((size_t)num_colors * 2) + ((size_t)scale_x * scale_y));
+                printf("wrote %lld frames, %.1f%% of the v1 size\n", output.records, (output.record_bytes * 100.0) / v1_bytes);
+                printf("indices: %lld raw, %lld delta, %lld rle, %lld lz\n",
+                    output.records - stats.delta_frames - stats.rle_frames - stats.lz_frames,
+                    stats.delta_frames, stats.rle_frames, stats.lz_frames);
+                printf("palettes: %lld stored inline, %lld kept from the previous frame, %lld from the dictionary\n",
+                    output.palettes.inlined, output.palettes.kept, output.palettes.stored);
+            }
+            if (appvar_prefix && (output.parts > 0)) {
+                printf("split into %d appvar(s), %s00 - %s%02d\n", output.parts, appvar_prefix, appvar_prefix, output.parts - 1);
+            }
+            if (target_fps > 0.0) {
+                printf("%.1f frames per second (target %.1f)\n", stats.frames_written / elapsed_time, target_fps);
+                for (int speed = SPEED_MIN; speed <= SPEED_MAX; speed++) {
+                    if (stats.frames_at_speed[speed] > 0) {
+                        printf("  speed %d: %lld frames\n", speed, stats.frames_at_speed[speed]);
+                    }
+                }
+            }
+            if (stats.processing_errors > 0) {
+                printf("%d frame(s) failed to process\n", stats.processing_errors);
+            }
         }
         {   //prepare to terminate program
-            fclose(file);
             show_cursor();
+            if (output_close(&output, stats.frames_written)) {
+                perror("error closing output file");
+                return 1;
+            }
+            if ((decoder_type != DECODER_PNG) && frame_stream_close(&frame_stream)) {
+                return 1;
+            }
+            if (pipeline_err) {
+                return 1;
+            }
         }
     }
     
@@ -472,8 +851,49 @@ void print_instructions(void) {
     printf("  -q, --quality <min:max>     : Quantization quality range (0-100, default: 0:100)\n");
     printf("  -b, --min-brightness <factor>: Minimum brightness factor (default: 4)\n");
     printf("  -d, --dither <level>        : Dithering level (0.0-1.0, default: 1.0)\n");
-    printf("        0.0 = no dithering, 1.0 = full dithering\n");
+    printf("        0.0 = no dithering (remapped with a built-in rgb555 table), 1.0 = full dithering\n");
+    printf("      --dither-mode <mode>    : diffusion, bayer4, bayer8 or bluenoise (default: diffusion)\n");
+    printf("        bayer/bluenoise = ordered dithering in the rgb555 table remap, much faster and steady from frame to frame\n");
     printf("  -p, --palette <num_colors>  : Max colors for each frame (default: 256)\n");
+    printf("      --decoder <png|pipe|libav>: Frame source (default: png)\n");
+    printf("        png = extract frames to a folder, pipe = stream raw frames from ffmpeg\n");
+    printf("        libav = decode in-process (needs a 'make LIBAV=1' build)\n");
+    printf("      --decode-segments <n>   : Decode the range as n keyframe-aligned segments in parallel (libav only, default: 1)\n");
+    printf("      --write-mode <mode>     : stream, direct, pwrite or mmap (default: stream)\n");
+    printf("        stream/direct = one writer fills 4 MB buffers that another thread flushes, direct = with O_DIRECT\n");
+    printf("        pwrite/mmap = workers write each frame at its final offset, failed frames are left blank\n");
+    printf("      --format <v1|v2>        : Output layout (default: v1)\n");
+    printf("        v1 = palette + indices per frame, v2 = header and size-prefixed records that store only the runs\n");
+    printf("        of changed indices and point back to palettes already written (needs --write-mode stream or direct)\n");
+    printf("      --palette-dict <entries>: v2: palettes kept for records to point back to instead of storing them again (0-%d, default: %d)\n",
+        PALETTE_DICTIONARY_MAX, PALETTE_DICTIONARY_DEFAULT);
+    printf("      --appvar <name>         : Write TI-84 Plus CE appvars <name>00.8xv, <name>01.8xv, ... next to the output file instead of it\n");
+    printf("        (name: 1-%d letters and digits), each one holds whole frames (needs --write-mode stream)\n", APPVAR_PREFIX_LENGTH);
+    printf("      --appvar-size <bytes>   : Largest appvar to write (%d-%d, default: %d)\n", APPVAR_MIN_SIZE, APPVAR_MAX_SIZE, APPVAR_MAX_SIZE);
+    printf("      --compress <mode>       : v2: none, rle, lz or best (default: none)\n");
+    printf("        each frame keeps the smallest of its raw indices, the runs against the previous frame and\n");
+    printf("        the chosen codec (best = both), compressed on the worker threads\n");
+    printf("      --quantizer <backend>   : Palette search: liq, rgb555, octree or kmeans (default: liq)\n");
+    printf("        rgb555 = fast median cut in the 15-bit space the output keeps, octree = octree in that space,\n");
+    printf("        kmeans = median cut refined by k-means (built-in ones: ordered dithering only, ignore -q)\n");
+    printf("      --histogram <image|rgb555>: What libimagequant builds its palette from (default: image)\n");
+    printf("        rgb555 = only the distinct 15-bit colors of each frame and their counts, a much smaller input\n");
+    printf("      --palette-reuse <quality>: Remap with the previous frame's palette while that keeps this quality (1-100, default: off)\n");
+    printf("        rated by libimagequant on the -q scale (liq only)\n");
+    printf("      --warm-start <rounds>   : Refine the previous frame's palette with up to this many k-means rounds instead of a new search (default: off)\n");
+    printf("        falls back to it when --palette-reuse rejects the previous palette, chains restart every --chain-length frames\n");
+    printf("      --fades <levels>        : Skip the quantizer for flat frames and brightness fades within this many levels (1-64, default: off)\n");
+    printf("        flat = one color, fade = the previous frame's indices under its palette scaled to the new brightness\n");
+    printf("      --dedup <levels>        : Reuse the previous frame's palette and indices when no channel differs by more than this (0 = identical, default: off)\n");
+    printf("        the first frame of each chain (every --chain-length frames) is always quantized, so it is never deduplicated\n");
+    printf("      --chain-length <frames> : Frames between fresh palettes with --palette-reuse, --warm-start, --fades or --dedup (default: 12)\n");
+    printf("      --scene-palettes <cut %%>: One palette per shot, a new shot starts where this %% of the colors change (1-100, default: off)\n");
+    printf("      --target-fps <fps>      : Raise or lower libimagequant's speed (1-10) per frame to encode this many frames per second (liq only)\n");
+    printf("      --time-budget <time>    : Same, with the rate worked out from the frame count and this time (HH:MM:SS or seconds)\n");
+    printf("      --frame-threads <n|auto>: Threads per frame for the histogram and remap (default: 1)\n");
+    printf("        error diffusion is remapped in bands of rows, the error doesn't carry across bands\n");
+    printf("        auto = split frames when the clip is shorter than the thread count or frames are large\n");
+    printf("      --palette-sample <%%>    : Search each palette from this %% of the pixels, every pixel is still remapped (1-100, default: 100)\n");
     printf("  -v, --version               : Show version information\n");
     printf("  -h, --help                  : Show this help message\n");
     printf("\nExample:\n");
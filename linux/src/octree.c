@@ -0,0 +1,143 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Octree palette search
+ *--------------------------------------
+*/
+
+#include "octree.h"
+#include "rgb555.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define OCTREE_DEPTH 5
+//1 + 8 + 64 + 512 + 4096 + 32768, every node a full tree over 5-bit channels can have
+#define OCTREE_MAX_NODES 37449
+
+typedef struct {
+    int32_t child[8];       //0 = none (node 0 is the root, so it is never a child)
+    uint64_t count;
+    uint64_t sum[3];        //5-bit channel values times their counts, for the mean
+    int children;
+    int leaf;
+} OctreeNode;
+
+typedef struct {
+    uint64_t count;
+    int32_t node;
+} Candidate;
+
+static int compare_candidates(const void *a, const void *b) {
+    const Candidate *ca = a, *cb = b;
+    if (ca->count != cb->count) {
+        return (ca->count < cb->count) ? -1 : 1;
+    }
+    //same count: tree order, so the result never depends on qsort
+    return (ca->node < cb->node) ? -1 : 1;
+}
+
+static void collect_leaves(const OctreeNode *nodes, int32_t n, liq_palette *palette, unsigned int *entry) {
+    const OctreeNode *node = &nodes[n];
+    if (node->leaf) {
+        int mean[3];
+        for (int axis = 0; axis < 3; axis++) {
+            mean[axis] = (int)((node->sum[axis] + (node->count / 2)) / node->count);
+        }
+        palette->entries[*entry].r = RGB555_EXPAND(mean[0]);
+        palette->entries[*entry].g = RGB555_EXPAND(mean[1]);
+        palette->entries[*entry].b = RGB555_EXPAND(mean[2]);
+        palette->entries[*entry].a = 255;
+        (*entry)++;
+        return;
+    }
+    for (int c = 0; c < 8; c++) {
+        if (node->child[c]) {
+            collect_leaves(nodes, node->child[c], palette, entry);
+        }
+    }
+}
+
+int octree_palette(Arena *arena, const uint32_t *histogram, int num_colors, liq_palette *palette) {
+    OctreeNode *nodes = arena_alloc(arena, OCTREE_MAX_NODES * sizeof(OctreeNode));
+    int32_t *level_nodes[OCTREE_DEPTH];
+    int level_count[OCTREE_DEPTH] = {0};
+    Candidate *candidates = arena_alloc(arena, (1 << (3 * (OCTREE_DEPTH - 1))) * sizeof(Candidate));
+    if (!nodes || !candidates) {
+        return 1;
+    }
+    for (int level = 0; level < OCTREE_DEPTH; level++) {
+        //a level holds at most 8^level nodes
+        level_nodes[level] = arena_alloc(arena, (1 << (3 * level)) * sizeof(int32_t));
+        if (!level_nodes[level]) {
+            return 1;
+        }
+    }
+
+    //insert every occupied key, the top bit of each channel picks the first child
+    int node_count = 1;
+    int leaves = 0;
+    memset(&nodes[0], 0, sizeof(OctreeNode));
+    level_nodes[0][level_count[0]++] = 0;
+    for (int key = 0; key < RGB555_COLORS; key++) {
+        if (!histogram[key]) {
+            continue;
+        }
+        int rgb[3] = {key >> 10, (key >> 5) & 0x1F, key & 0x1F};
+        int32_t n = 0;
+        for (int level = 0; ; level++) {
+            OctreeNode *node = &nodes[n];
+            node->count += histogram[key];
+            for (int axis = 0; axis < 3; axis++) {
+                node->sum[axis] += (uint64_t)rgb[axis] * histogram[key];
+            }
+            if (level == OCTREE_DEPTH) {
+                node->leaf = 1;
+                break;
+            }
+
+            int bit = OCTREE_DEPTH - 1 - level;
+            int c = (((rgb[0] >> bit) & 1) << 2) | (((rgb[1] >> bit) & 1) << 1) | ((rgb[2] >> bit) & 1);
+            if (!node->child[c]) {
+                int32_t added = node_count++;
+                memset(&nodes[added], 0, sizeof(OctreeNode));
+                node->child[c] = added;
+                node->children++;
+                if (level + 1 < OCTREE_DEPTH) {
+                    level_nodes[level + 1][level_count[level + 1]++] = added;
+                } else {
+                    leaves++;
+                }
+            }
+            n = node->child[c];
+        }
+    }
+
+    //fold the deepest level first, smallest counts first, until the leaves fit
+    for (int level = OCTREE_DEPTH - 1; (level >= 0) && (leaves > num_colors); level--) {
+        for (int i = 0; i < level_count[level]; i++) {
+            int32_t n = level_nodes[level][i];
+            candidates[i].count = nodes[n].count;
+            candidates[i].node = n;
+        }
+        qsort(candidates, level_count[level], sizeof(Candidate), compare_candidates);
+        for (int i = 0; (i < level_count[level]) && (leaves > num_colors); i++) {
+            OctreeNode *node = &nodes[candidates[i].node];
+            leaves -= node->children - 1;
+            node->leaf = 1;
+        }
+    }
+
+    memset(palette, 0, sizeof(liq_palette));
+    palette->count = num_colors;
+    unsigned int entry = 0;
+    if (leaves > 0) {
+        collect_leaves(nodes, 0, palette, &entry);
+    }
+    for (unsigned int i = entry; i < (unsigned int)num_colors; i++) {
+        palette->entries[i].a = 255;
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Octree palette search
+ *--------------------------------------
+*/
+
+#ifndef FBIN_OCTREE_H
+#define FBIN_OCTREE_H
+
+#include <stdint.h>
+
+#include "../include/libimagequant.h"
+#include "arena.h"
+
+//octree over the RGB555_COLORS counts of a frame, one level per bit of the 5-bit
+//channels: the least populated nodes of the deepest level are folded into their parent
+//until num_colors leaves remain, each leaf's mean becomes an entry (unused ones are black)
+//scratch memory comes from the arena. returns 0 on success, 1 when out of memory
+int octree_palette(Arena *arena, const uint32_t *histogram, int num_colors, liq_palette *palette);
+
+#endif
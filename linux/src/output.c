@@ -0,0 +1,524 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Output file writing
+ *--------------------------------------
+*/
+
+#define _GNU_SOURCE
+#include "output.h"
+#include "encode.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+int parse_write_mode(const char *str, WriteMode *mode) {
+    if (strcmp(str, "stream") == 0) {
+        *mode = WRITE_STREAM;
+    } else if (strcmp(str, "direct") == 0) {
+        *mode = WRITE_DIRECT;
+    } else if (strcmp(str, "pwrite") == 0) {
+        *mode = WRITE_PWRITE;
+    } else if (strcmp(str, "mmap") == 0) {
+        *mode = WRITE_MMAP;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+static void pack_colors_scalar(unsigned char *dst, const liq_color *entries, int first, int last) {
+    for (int j = first; j < last; j++) {
+        liq_color rgba_color = entries[j];
+
+        uint16_t rgb1555_color = 0;
+        rgb1555_color = (((rgba_color.r >> 3) & 0x1F) << 10) |
+                        (((rgba_color.g >> 3) & 0x1F) << 5)  |
+                        (((rgba_color.b >> 3) & 0x1F) << 0);
+        dst[(j * 2) + 0] = (unsigned char)(rgb1555_color & 0xFF);
+        dst[(j * 2) + 1] = (unsigned char)(rgb1555_color >> 8);
+    }
+}
+
+//8 colors per step: each rgba color is one 32-bit lane (r in the low byte), the three
+//5-bit fields are shifted into place and the lanes packed down to 16 bits (little-endian)
+__attribute__((target("sse4.1")))
+static int pack_colors_sse4(unsigned char *dst, const liq_color *entries, int count) {
+    const __m128i top5 = _mm_set1_epi32(0xF8);
+    int j = 0;
+    for (; j + 8 <= count; j += 8) {
+        __m128i lanes[2] = {
+            _mm_loadu_si128((const __m128i *)(entries + j)),
+            _mm_loadu_si128((const __m128i *)(entries + j + 4))
+        };
+        for (int k = 0; k < 2; k++) {
+            __m128i v = lanes[k];
+            __m128i r = _mm_slli_epi32(_mm_and_si128(v, top5), 7);
+            __m128i g = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v, 8), top5), 2);
+            __m128i b = _mm_srli_epi32(_mm_and_si128(_mm_srli_epi32(v, 16), top5), 3);
+            lanes[k] = _mm_or_si128(_mm_or_si128(r, g), b);
+        }
+        _mm_storeu_si128((__m128i *)(dst + (j * 2)), _mm_packus_epi32(lanes[0], lanes[1]));
+    }
+    return j;
+}
+
+void pack_palette(unsigned char *dst, const liq_palette *palette, int num_colors) {
+    int packed = __builtin_cpu_supports("sse4.1") ? pack_colors_sse4(dst, palette->entries, num_colors) : 0;
+    pack_colors_scalar(dst, palette->entries, packed, num_colors);
+}
+
+int parse_output_format(const char *str, OutputFormat *format) {
+    if (strcmp(str, "v1") == 0) {
+        *format = FORMAT_V1;
+    } else if (strcmp(str, "v2") == 0) {
+        *format = FORMAT_V2;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+int output_is_stream(const FrameOutput *out) {
+    return (out->mode == WRITE_STREAM) || (out->mode == WRITE_DIRECT);
+}
+
+static int open_stream(FrameOutput *out, const char *filename) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (out->appvar) {
+        //the flush thread opens each part as it reaches it
+    }
+    else if (out->mode == WRITE_DIRECT) {
+        out->fd = open(filename, flags | O_DIRECT, 0644);
+        out->direct = (out->fd >= 0);
+        if ((out->fd < 0) && (errno == EINVAL)) {
+            printf("O_DIRECT isn't supported for '%s', writing through the page cache\n", filename);
+        }
+    }
+    if ((out->fd < 0) && !out->appvar) {
+        out->fd = open(filename, flags, 0644);
+    }
+    if ((out->fd < 0) && !out->appvar) {
+        perror("error opening output file\n");
+        return 1;
+    }
+
+    for (int i = 0; i < OUTPUT_BUFFERS; i++) {
+        //page aligned, as O_DIRECT needs (and harmless without it)
+        void *data = NULL;
+        if (posix_memalign(&data, (size_t)sysconf(_SC_PAGESIZE), OUTPUT_BUFFER_SIZE) != 0) {
+            fprintf(stderr, "failed to allocate the output buffers\n");
+            return 1;
+        }
+        out->buffers[i].data = data;
+        out->buffers[i].used = 0;
+        out->buffers[i].ends_part = 0;
+    }
+    if (queue_init(&out->full, OUTPUT_BUFFERS + 1) || queue_init(&out->empty, OUTPUT_BUFFERS)) {
+        fprintf(stderr, "failed to allocate the output buffers\n");
+        return 1;
+    }
+    for (int i = 0; i < OUTPUT_BUFFERS; i++) {
+        queue_push(&out->empty, &out->buffers[i]);
+    }
+    atomic_init(&out->flush_failed, 0);
+
+    if (out->appvar) {
+        printf("writing %s00.8xv, %s01.8xv, ... to '%s' (up to %zu bytes each)\n", out->appvar_prefix,
+               out->appvar_prefix, out->appvar_folder, out->appvar_size);
+        return 0;
+    }
+    printf("opened '%s' for %swriting (%d x %d KB buffers)\n", filename, out->direct ? "O_DIRECT " : "",
+           OUTPUT_BUFFERS, OUTPUT_BUFFER_SIZE / 1024);
+    return 0;
+}
+
+static void free_stream(FrameOutput *out) {
+    for (int i = 0; i < OUTPUT_BUFFERS; i++) {
+        free(out->buffers[i].data);
+    }
+    queue_destroy(&out->full);
+    queue_destroy(&out->empty);
+}
+
+//copies into the buffer being filled, handing each full one to the flush thread
+static void append(FrameOutput *out, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        if (!out->filling) {
+            out->filling = queue_pop(&out->empty);
+        }
+        OutputBuffer *buffer = out->filling;
+        size_t room = OUTPUT_BUFFER_SIZE - buffer->used;
+        size_t part = (size < room) ? size : room;
+        memcpy(buffer->data + buffer->used, data, part);
+        buffer->used += part;
+        data += part;
+        size -= part;
+        if (buffer->used == OUTPUT_BUFFER_SIZE) {
+            queue_push(&out->full, buffer);
+            out->filling = NULL;
+        }
+    }
+}
+
+//data goes through here, so an appvar part's size and checksum follow what is written
+static void append_data(FrameOutput *out, const unsigned char *data, size_t size) {
+    if (out->appvar) {
+        out->part_size += size;
+        out->part_sum += appvar_sum(data, size);
+    }
+    append(out, data, size);
+}
+
+static void end_part(FrameOutput *out) {
+    char name[APPVAR_NAME_LENGTH + 1];
+    unsigned char head[APPVAR_HEAD_SIZE];
+    appvar_name(name, out->appvar_prefix, out->parts - 1);
+    unsigned int checksum = appvar_head(head, name, out->part_size, out->part_sum);
+    if (out->parts == 1) {
+        out->first_part_size = out->part_size;
+        out->first_part_sum = out->part_sum;
+    }
+
+    //the checksum ends the part in the buffer that takes the head to the flush thread
+    if (out->filling && (OUTPUT_BUFFER_SIZE - out->filling->used < APPVAR_CHECKSUM_SIZE)) {
+        queue_push(&out->full, out->filling);
+        out->filling = NULL;
+    }
+    if (!out->filling) {
+        out->filling = queue_pop(&out->empty);
+    }
+    OutputBuffer *buffer = out->filling;
+    buffer->data[buffer->used++] = (unsigned char)(checksum & 0xFF);
+    buffer->data[buffer->used++] = (unsigned char)(checksum >> 8);
+    memcpy(buffer->head, head, APPVAR_HEAD_SIZE);
+    buffer->ends_part = 1;
+    queue_push(&out->full, buffer);
+    out->filling = NULL;
+    out->part_open = 0;
+}
+
+//appvar output: ends the part being filled when 'size' more bytes won't fit it, and starts
+//the next one. returns 1 once every part name is used
+static int make_room(FrameOutput *out, size_t size) {
+    if (!out->appvar) {
+        return 0;
+    }
+    if (out->part_open && (out->part_size + size > out->appvar_size)) {
+        end_part(out);
+    }
+    if (!out->part_open) {
+        if (out->parts == APPVAR_MAX_PARTS) {
+            //the finished parts are still flushed, the rest of the frames are dropped
+            if (!out->parts_exhausted) {
+                fprintf(stderr, "the output needs more than %d appvars, raise --appvar-size\n", APPVAR_MAX_PARTS);
+                out->parts_exhausted = 1;
+            }
+            return 1;
+        }
+        //the flush thread writes the real head over this once the part is complete
+        unsigned char head[APPVAR_HEAD_SIZE] = {0};
+        append(out, head, APPVAR_HEAD_SIZE);
+        out->parts++;
+        out->part_open = 1;
+        out->part_size = 0;
+        out->part_sum = 0;
+    }
+    return 0;
+}
+
+int output_open(FrameOutput *out, const char *filename, const OutputOptions *opts) {
+    WriteMode mode = opts->mode;
+    long long expected_frames = opts->expected_frames;
+
+    memset(out, 0, sizeof(FrameOutput));
+    out->mode = mode;
+    out->format = opts->format;
+    out->fd = -1;
+    out->width = opts->width;
+    out->height = opts->height;
+    out->num_colors = opts->num_colors;
+    out->pixel_count = (size_t)opts->width * opts->height;
+    out->frame_size = (2 * (size_t)opts->num_colors) + out->pixel_count;
+    out->palettes.entries = opts->palette_dictionary;
+    out->compress = opts->compress;
+    if (opts->appvar_prefix) {
+        //the parts go in the folder the output file would have
+        const char *slash = strrchr(filename, '/');
+        out->appvar = 1;
+        out->appvar_size = opts->appvar_size;
+        snprintf(out->appvar_prefix, sizeof(out->appvar_prefix), "%s", opts->appvar_prefix);
+        if (slash) {
+            snprintf(out->appvar_folder, sizeof(out->appvar_folder), "%.*s", (int)(slash - filename), filename);
+        } else {
+            snprintf(out->appvar_folder, sizeof(out->appvar_folder), ".");
+        }
+    }
+
+    if (output_is_stream(out)) {
+        if (open_stream(out, filename)) {
+            if (out->fd >= 0) {
+                close(out->fd);
+            }
+            free_stream(out);
+            return 1;
+        }
+        if (out->format == FORMAT_V2) {
+            //the frame count is filled in by output_close
+            unsigned char header[FORMAT_HEADER_SIZE];
+            format_header(header, out->width, out->height, out->num_colors, out->palettes.entries, 0);
+            make_room(out, FORMAT_HEADER_SIZE);
+            append_data(out, header, FORMAT_HEADER_SIZE);
+        }
+        return 0;
+    }
+
+    out->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out->fd < 0) {
+        perror("error opening output file\n");
+        return 1;
+    }
+
+    if (expected_frames > 0) {
+        //reserve the whole file up front so workers never extend it one frame at a time
+        off_t size = (off_t)(expected_frames * out->frame_size);
+        if ((fallocate(out->fd, 0, 0, size) != 0) && (ftruncate(out->fd, size) != 0)) {
+            perror("failed to pre-size output file");
+            close(out->fd);
+            return 1;
+        }
+
+        if (mode == WRITE_MMAP) {
+            void *map = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, out->fd, 0);
+            if (map == MAP_FAILED) {
+                perror("failed to map output file");
+                close(out->fd);
+                return 1;
+            }
+            out->map = map;
+            out->map_frames = expected_frames;
+        }
+        printf("pre-sized '%s' for %lld frames\n", filename, expected_frames);
+    }
+    else if (mode == WRITE_MMAP) {
+        printf("frame count unknown, frames are written with pwrite\n");
+    }
+    printf("opened '%s' for %s writes\n", filename, (mode == WRITE_MMAP) ? "mmap" : "pwrite");
+    return 0;
+}
+
+int output_write_frame(FrameOutput *out, const ProcessedFrame *frame) {
+    if (out->format == FORMAT_V2) {
+        unsigned char head[RECORD_HEADER_SIZE + (2 * 256)];
+        size_t head_size = encode_record_head(&out->palettes, frame->packed_palette, out->num_colors,
+                                              frame->record_flags, frame->record_size, head);
+        if (make_room(out, head_size + frame->record_size)) {
+            return 1;
+        }
+        append_data(out, head, head_size);
+        append_data(out, frame->record, frame->record_size);
+        out->records++;
+        out->record_bytes += (long long)(head_size + frame->record_size);
+    }
+    else {
+        if (make_room(out, out->frame_size)) {
+            return 1;
+        }
+        append_data(out, frame->packed_palette, 2 * (size_t)out->num_colors);
+        append_data(out, frame->indexed_pixels, out->pixel_count);
+    }
+    //a failed flush is reported by the next frame, the rest are still packed and dropped
+    return atomic_load(&out->flush_failed);
+}
+
+void output_end_stream(FrameOutput *out) {
+    if (out->part_open) {
+        end_part(out);
+    }
+    if (out->filling && (out->filling->used > 0)) {
+        queue_push(&out->full, out->filling);
+    }
+    out->filling = NULL;
+    queue_push(&out->full, NULL);
+}
+
+static int write_buffer(FrameOutput *out, const OutputBuffer *buffer) {
+    //O_DIRECT writes whole blocks, only the last (partial) buffer goes through the page cache
+    if (out->direct && (buffer->used % OUTPUT_BUFFER_SIZE != 0)) {
+        int flags = fcntl(out->fd, F_GETFL);
+        if ((flags < 0) || (fcntl(out->fd, F_SETFL, flags & ~O_DIRECT) != 0)) {
+            return 1;
+        }
+        out->direct = 0;
+    }
+
+    size_t done = 0;
+    while (done < buffer->used) {
+        ssize_t written = write(out->fd, buffer->data + done, buffer->used - done);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+        done += (size_t)written;
+    }
+    return 0;
+}
+
+static void part_path(const FrameOutput *out, int part, char *path, size_t size) {
+    char name[APPVAR_NAME_LENGTH + 1];
+    appvar_name(name, out->appvar_prefix, part);
+    snprintf(path, size, "%s/%s.8xv", out->appvar_folder, name);
+}
+
+//appvar output: opens each part at its first buffer and writes the head over the placeholder at its last
+static int write_part_buffer(FrameOutput *out, const OutputBuffer *buffer) {
+    if (out->fd < 0) {
+        char path[PATH_MAX + APPVAR_NAME_LENGTH + 8];
+        part_path(out, out->flushed_parts, path, sizeof(path));
+        out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out->fd < 0) {
+            return 1;
+        }
+    }
+
+    int err = write_buffer(out, buffer);
+    if (buffer->ends_part) {
+        if (!err && (pwrite(out->fd, buffer->head, APPVAR_HEAD_SIZE, 0) != APPVAR_HEAD_SIZE)) {
+            err = 1;
+        }
+        if (close(out->fd) != 0) {
+            err = 1;
+        }
+        out->fd = -1;
+        out->flushed_parts++;
+    }
+    return err;
+}
+
+void output_flush_stage(FrameOutput *out) {
+    for (;;) {
+        OutputBuffer *buffer = queue_pop(&out->full);
+        if (!buffer) {
+            break;
+        }
+        if (!atomic_load(&out->flush_failed) &&
+            (out->appvar ? write_part_buffer(out, buffer) : write_buffer(out, buffer))) {
+            perror("failed to write output file");
+            atomic_store(&out->flush_failed, 1);
+        }
+        buffer->used = 0;
+        buffer->ends_part = 0;
+        queue_push(&out->empty, buffer);
+    }
+}
+
+//v2 in appvars: the header with the frame count goes into the first part, whose checksum
+//is moved by the difference of the two headers' sums
+static int patch_first_part(FrameOutput *out, const unsigned char *header) {
+    char path[PATH_MAX + APPVAR_NAME_LENGTH + 8];
+    char name[APPVAR_NAME_LENGTH + 1];
+    unsigned char head[APPVAR_HEAD_SIZE];
+    unsigned char old_header[FORMAT_HEADER_SIZE];
+    unsigned char checksum[APPVAR_CHECKSUM_SIZE];
+
+    format_header(old_header, out->width, out->height, out->num_colors, out->palettes.entries, 0);
+    unsigned long sum = out->first_part_sum - appvar_sum(old_header, FORMAT_HEADER_SIZE) + appvar_sum(header, FORMAT_HEADER_SIZE);
+    appvar_name(name, out->appvar_prefix, 0);
+    unsigned int value = appvar_head(head, name, out->first_part_size, sum);
+    checksum[0] = (unsigned char)(value & 0xFF);
+    checksum[1] = (unsigned char)(value >> 8);
+
+    part_path(out, 0, path, sizeof(path));
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    int err = (pwrite(fd, header, FORMAT_HEADER_SIZE, APPVAR_HEAD_SIZE) != FORMAT_HEADER_SIZE) ||
+              (pwrite(fd, checksum, APPVAR_CHECKSUM_SIZE, (off_t)(APPVAR_HEAD_SIZE + out->first_part_size)) != APPVAR_CHECKSUM_SIZE);
+    if (close(fd) != 0) {
+        err = 1;
+    }
+    return err;
+}
+
+int output_write_frame_at(FrameOutput *out, const ProcessedFrame *frame, long long index) {
+    size_t palette_size = 2 * (size_t)out->num_colors;
+    off_t offset = (off_t)(index * out->frame_size);
+
+    if (index < out->map_frames) {
+        unsigned char *dst = out->map + offset;
+        memcpy(dst, frame->packed_palette, palette_size);
+        memcpy(dst + palette_size, frame->indexed_pixels, out->pixel_count);
+        return 0;
+    }
+
+    struct iovec parts[2] = {
+        { (void *)frame->packed_palette, palette_size },
+        { frame->indexed_pixels, out->pixel_count }
+    };
+    ssize_t written = pwritev(out->fd, parts, 2, offset);
+    if ((written < 0) || ((size_t)written != out->frame_size)) {
+        perror("failed to write frame");
+        return 1;
+    }
+    return 0;
+}
+
+int output_close(FrameOutput *out, long long frames) {
+    int err = 0;
+
+    if (output_is_stream(out)) {
+        err = atomic_load(&out->flush_failed) || out->parts_exhausted;
+        if ((out->format == FORMAT_V2) && !err) {
+            unsigned char header[FORMAT_HEADER_SIZE];
+            //failed frames have no record
+            format_header(header, out->width, out->height, out->num_colors, out->palettes.entries, out->records);
+            if (out->appvar) {
+                if (patch_first_part(out, header)) {
+                    perror("failed to write the frame count");
+                    err = 1;
+                }
+            }
+            else {
+                //a 16 byte write at offset 0 can't go through O_DIRECT
+                int flags = fcntl(out->fd, F_GETFL);
+                if ((flags < 0) || (fcntl(out->fd, F_SETFL, flags & ~O_DIRECT) != 0) ||
+                    (pwrite(out->fd, header, FORMAT_HEADER_SIZE, 0) != FORMAT_HEADER_SIZE)) {
+                    perror("failed to write the frame count");
+                    err = 1;
+                }
+            }
+        }
+        //appvar parts are closed by the flush thread, unless a failed write left one open
+        if ((out->fd >= 0) && (close(out->fd) != 0)) {
+            err = 1;
+        }
+        free_stream(out);
+        return err;
+    }
+
+    if (out->map) {
+        munmap(out->map, (size_t)(out->map_frames * out->frame_size));
+    }
+    //drop the unused tail of an over-estimated pre-size
+    if (ftruncate(out->fd, (off_t)(frames * out->frame_size)) != 0) {
+        perror("failed to truncate output file");
+        err = 1;
+    }
+    if (close(out->fd) != 0) {
+        err = 1;
+    }
+    return err;
+}
@@ -0,0 +1,122 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Output file writing
+ *--------------------------------------
+*/
+
+#ifndef FBIN_OUTPUT_H
+#define FBIN_OUTPUT_H
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "appvar.h"
+#include "encode.h"
+#include "quantize.h"
+#include "queue.h"
+
+//the stream modes pack frames into buffers of this size (a multiple of any page size)
+#define OUTPUT_BUFFER_SIZE (1 << 22)
+#define OUTPUT_BUFFERS 2
+
+typedef enum {
+    WRITE_STREAM,   //the writer thread appends frames in order
+    WRITE_DIRECT,   //the same, written with O_DIRECT past the page cache
+    WRITE_PWRITE,   //workers pwrite each frame at index * frame_size
+    WRITE_MMAP      //workers copy each frame into a mapping of the pre-sized file
+} WriteMode;
+
+typedef enum {
+    FORMAT_V1,      //frames back to back: palette + indices, all the same size
+    FORMAT_V2       //a header, then one size-prefixed record per frame (see encode.h)
+} OutputFormat;
+
+typedef struct {
+    WriteMode mode;
+    OutputFormat format;
+    int width, height;
+    int num_colors;
+    long long expected_frames;  //negative when unknown, pre-sizes the file in the direct modes
+    int palette_dictionary;     //v2: palettes records can point back to (0 - PALETTE_DICTIONARY_MAX)
+    CompressMode compress;      //v2: codecs the workers try on each frame's indices
+    const char *appvar_prefix;  //NULL = one file, otherwise .8xv parts next to it (stream mode only)
+    size_t appvar_size;         //data bytes per part, frames are never split
+} OutputOptions;
+
+typedef struct {
+    unsigned char *data;        //OUTPUT_BUFFER_SIZE bytes, page aligned
+    size_t used;
+    int ends_part;              //appvar output: the last buffer of a part, carrying its head
+    unsigned char head[APPVAR_HEAD_SIZE];
+} OutputBuffer;
+
+typedef struct {
+    WriteMode mode;
+    OutputFormat format;
+    int fd;
+    int width, height;
+    int num_colors;
+    size_t pixel_count;
+    size_t frame_size;          //v1: 2 * num_colors + scale_x * scale_y
+    unsigned char *map;
+    long long map_frames;       //frames covered by the mapping, later ones use pwrite
+
+    //stream modes: the writer packs frames into one buffer while the flush thread writes
+    //out the other, they trade buffers through the two queues
+    OutputBuffer buffers[OUTPUT_BUFFERS];
+    OutputBuffer *filling;
+    FrameQueue full;            //buffers waiting to be written, NULL stops the flush thread
+    FrameQueue empty;           //written buffers back for the writer
+    int direct;                 //the file is open with O_DIRECT
+    atomic_int flush_failed;
+
+    CompressMode compress;
+
+    //appvar output: the writer cuts the stream into parts at frame boundaries and keeps each
+    //part's size and checksum as it goes, the flush thread opens and finishes the files
+    int appvar;
+    char appvar_prefix[APPVAR_PREFIX_LENGTH + 1];
+    char appvar_folder[PATH_MAX];
+    size_t appvar_size;
+    int parts;                  //parts begun
+    int parts_exhausted;        //every part name is used, later frames were dropped
+    int part_open;
+    size_t part_size;
+    unsigned long part_sum;
+    size_t first_part_size;     //v2 rewrites its header in the first part on close
+    unsigned long first_part_sum;
+    int flushed_parts;          //flush thread only
+
+    //v2: written by the writer thread only
+    PaletteDictionary palettes;
+    long long records;
+    long long record_bytes;
+} FrameOutput;
+
+int parse_write_mode(const char *str, WriteMode *mode);
+int parse_output_format(const char *str, OutputFormat *format);
+
+//v2 needs a stream mode, its records differ in size
+int output_open(FrameOutput *out, const char *filename, const OutputOptions *opts);
+//WRITE_STREAM / WRITE_DIRECT go through the ordered writer, the other modes through the workers
+int output_is_stream(const FrameOutput *out);
+//stream modes: called by one thread, in frame order (v2 adds the palette part to frame->record)
+int output_write_frame(FrameOutput *out, const ProcessedFrame *frame);
+//stream modes: after the last frame, hands over the partial buffer and stops the flush thread
+void output_end_stream(FrameOutput *out);
+//stream modes: run by a thread of its own next to the writer, returns after output_end_stream
+void output_flush_stage(FrameOutput *out);
+//WRITE_PWRITE / WRITE_MMAP: called by any thread, in any order
+int output_write_frame_at(FrameOutput *out, const ProcessedFrame *frame, long long index);
+//cuts direct outputs to exactly 'frames' frames, v2 puts its record count in the header
+int output_close(FrameOutput *out, long long frames);
+
+//packs the palette as little-endian rgb1555 (2 * num_colors bytes)
+void pack_palette(unsigned char *dst, const liq_palette *palette, int num_colors);
+
+#endif
@@ -0,0 +1,928 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Decode -> quantize -> write pipeline
+ *--------------------------------------
+*/
+
+#include "pipeline.h"
+#include "dedup.h"
+#include "encode.h"
+#include "fade.h"
+#include "queue.h"
+#include "scene.h"
+#include "../include/stb_image.h"
+#include <omp.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PATH_LENGTH 260
+#define PROGRESS_INTERVAL 25
+
+typedef struct Shot Shot;
+
+typedef struct FrameSlot {
+    long long frame_index;      //0-based position in the output
+    unsigned char *rgba;        //NULL for png frames, the worker loads those itself
+    Shot *shot;                 //scene palettes: the shot the frame is remapped against
+    struct FrameSlot *next_in_shot;
+    int failed;                 //scene palettes: the png couldn't be loaded into rgba
+} FrameSlot;
+
+//scene palettes: consecutive frames that share one histogram and one palette
+struct Shot {
+    liq_histogram *hist;
+    liq_palette palette;        //count is 0 when the shot couldn't be quantized
+    FrameSlot *first, *last;
+    int frame_count;
+    atomic_int remaining;       //frames not remapped yet, the shot is recycled at 0
+};
+
+typedef struct {
+    const PipelineConfig *cfg;
+    int lanes;
+
+    FrameQueue free_slots;      //empty rgba buffers, back from the workers
+    FrameQueue work;            //decoded frames waiting for a worker
+    FrameQueue done;            //quantized frames waiting for the writer
+    FrameSlot *slots;
+    unsigned char *rgba_buffers;
+
+    //reorder buffer, frame i lives in frames[i % ring] until it is written
+    //ring is one longer than the window, so the last written frame keeps its palette for the next one
+    int ring;
+    ProcessedFrame *frames;
+    ProcessedFrame **pending;
+    unsigned char *index_buffers;   //one frame of palette indices per reorder slot
+
+    //fades: the levels and luma of each frame in the reorder buffer, a fade frame keeps those of
+    //the searched frame (its anchor) whose indices it scales
+    FrameLevels *levels;
+    unsigned char *luma;
+
+    //duplicates: the hash and pixels of the frame each reorder slot's result was made from
+    //(a run of near matches is measured against its first frame)
+    uint64_t *hashes;
+    unsigned char *reference_rgba;
+
+    //v2 records: frame i is encoded against frame i-1 by whichever of their workers finishes
+    //second, arrivals[i % ring] counts the two. with compression each slot is followed by scratch space
+    unsigned char *record_buffers;
+    size_t record_stride;
+    atomic_int *arrivals;
+    long long delta_frames;     //writer only
+    long long rle_frames;
+    long long lz_frames;
+
+    //palette chains (reuse, warm starts): frame i sets quantized[i % ring] = i once its palette is final,
+    //a frame whose predecessor isn't there yet waits in parked[i % ring]
+    atomic_llong *quantized;
+    _Atomic(FrameSlot *) *parked;
+
+    //scene palettes: workers sign each frame and pass it on to the scene thread, which
+    //cuts the stream into shots and fills their histograms in order. a shot's palette
+    //is searched by one worker, then all of its frames are remapped in parallel
+    FrameQueue analyzed;        //signed frames waiting for the scene thread
+    FrameQueue shot_queue;      //closed shots waiting for a palette search
+    FrameQueue remaps;          //frames of quantized shots waiting to be remapped
+    FrameQueue free_shots;
+    Shot *shots;
+    unsigned int *signatures;   //SCENE_BINS per reorder slot
+    atomic_llong scene_tasks;   //shots and remaps queued or running
+    atomic_int scene_done;
+    atomic_llong shot_count;
+
+    atomic_llong written;
+    atomic_llong total;         //-1 until every decoder has finished
+    atomic_llong next_png;
+    atomic_int decoders_running;
+    atomic_int workers_running;
+    atomic_int aborted;         //a stage couldn't start, nothing more is quantized or written
+    atomic_int errors;
+    atomic_llong palettes_reused;
+    atomic_llong palettes_refined;
+    atomic_llong flat_frames;
+    atomic_llong fade_frames;
+    atomic_llong duplicate_frames;
+
+    SpeedControl speed;         //only used with a target fps
+
+    double start_time;
+    double first_write_time;
+} Pipeline;
+
+static void print_progress(long long written, long long total) {
+    // Move cursor to beginning of line, clear the line, and print the progress
+    printf("\r\033[K");  // \r moves cursor to start of line, \033[K clears to end of line
+    if (total > 0) {
+        printf("processing: %lld/%lld frames (%.1f%%)", written, total, ((float)written / total) * 100);
+    }
+    else {
+        //the total is still growing while ffmpeg streams
+        printf("processing: %lld frames", written);
+    }
+    fflush(stdout);
+}
+
+static int next_frame(Pipeline *p, int lane, FrameSlot *slot) {
+    const PipelineConfig *cfg = p->cfg;
+    if (cfg->decoder_type == DECODER_PNG) {
+        //png frames are only numbered here, loading them is parallel work
+        slot->frame_index = atomic_fetch_add(&p->next_png, 1);
+        return (slot->frame_index < cfg->png_frames);
+    }
+    return frame_stream_read(cfg->stream, lane, slot->rgba, &slot->frame_index);
+}
+
+//returns NULL once the pipeline is aborted, frames held by a chain or a shot never come back then
+static FrameSlot *take_free_slot(Pipeline *p) {
+    void *item;
+    int spins = 0;
+    while (!queue_try_pop(&p->free_slots, &item)) {
+        if (atomic_load(&p->aborted)) {
+            return NULL;
+        }
+        queue_backoff(&spins);
+    }
+    return item;
+}
+
+static void decode_stage(Pipeline *p, int lane) {
+    const PipelineConfig *cfg = p->cfg;
+
+    for (;;) {
+        FrameSlot *slot = take_free_slot(p);
+        if (!slot) {
+            break;
+        }
+        if (atomic_load(&p->aborted) || !next_frame(p, lane, slot)) {
+            queue_push(&p->free_slots, slot);
+            break;
+        }
+
+        //don't run further ahead of the writer than the window it can hold
+        int spins = 0;
+        while ((slot->frame_index - atomic_load(&p->written) >= cfg->window) && !atomic_load(&p->aborted)) {
+            queue_backoff(&spins);
+        }
+        queue_push(&p->work, slot);
+    }
+
+    if (atomic_fetch_sub(&p->decoders_running, 1) == 1) {
+        //last decoder out: publish the frame count and release the workers
+        long long total = (cfg->decoder_type == DECODER_PNG) ? cfg->png_frames : frame_stream_frame_count(cfg->stream);
+        atomic_store(&p->total, total);
+        for (int i = 0; i < cfg->workers; i++) {
+            queue_push(&p->work, NULL);
+        }
+    }
+}
+
+//palette reuse, warm starts, fades and duplicates all start from the previous frame's result
+static int uses_chains(const PipelineConfig *cfg) {
+    return (cfg->quant.reuse_quality > 0) || (cfg->quant.warm_rounds > 0) || (cfg->fade_tolerance > 0) || cfg->duplicates;
+}
+
+static int is_chained(const Pipeline *p, long long index) {
+    const PipelineConfig *cfg = p->cfg;
+    return uses_chains(cfg) && (index % cfg->chain_frames != 0);
+}
+
+//returns 1 when the frame's predecessor is quantized and the frame can run now,
+//0 when it was parked for whoever finishes the predecessor
+static int claim_chained_frame(Pipeline *p, FrameSlot *slot) {
+    long long index = slot->frame_index;
+    atomic_store(&p->parked[index % p->ring], slot);
+    if (atomic_load(&p->quantized[(index - 1) % p->ring]) != index - 1) {
+        return 0;
+    }
+    //the predecessor finished meanwhile, but its worker may have taken the frame already
+    return (atomic_exchange(&p->parked[index % p->ring], NULL) != NULL);
+}
+
+//returns 1 when the frame matches the one before it and took over its palette and indices
+static int duplicate_frame(Pipeline *p, const unsigned char *pixels, long long index, ProcessedFrame *frame) {
+    const PipelineConfig *cfg = p->cfg;
+    size_t pixel_count = (size_t)cfg->quant.scale_x * cfg->quant.scale_y;
+    long long reorder_slot = index % p->ring;
+    long long previous_slot = (index - 1) % p->ring;
+    unsigned char *reference = p->reference_rgba + (pixel_count * 4 * reorder_slot);
+    unsigned char *previous_reference = p->reference_rgba + (pixel_count * 4 * previous_slot);
+
+    //the hash only rules frames out quickly, a hit is confirmed against the kept pixels
+    uint64_t hash = frame_hash(pixels, pixel_count * 4);
+    const ProcessedFrame *previous = &p->frames[previous_slot];
+    int match = is_chained(p, index) && (previous->palette.count > 0) &&
+                (((p->hashes[previous_slot] == hash) && !memcmp(previous_reference, pixels, pixel_count * 4)) ||
+                 ((cfg->duplicate_tolerance > 0) && frames_match(previous_reference, pixels, pixel_count, cfg->duplicate_tolerance)));
+    if (!match) {
+        p->hashes[reorder_slot] = hash;
+        memcpy(reference, pixels, pixel_count * 4);
+        return 0;
+    }
+
+    p->hashes[reorder_slot] = p->hashes[previous_slot];
+    memcpy(reference, previous_reference, pixel_count * 4);
+    if (cfg->fade_tolerance > 0) {
+        //a fade after this frame is measured against the same levels as one after the previous
+        p->levels[reorder_slot] = p->levels[previous_slot];
+        memcpy(p->luma + (pixel_count * reorder_slot), p->luma + (pixel_count * previous_slot), pixel_count);
+    }
+    frame->palette = previous->palette;
+    memcpy(frame->indexed_pixels, p->index_buffers + (pixel_count * previous_slot), pixel_count);
+    atomic_fetch_add(&p->duplicate_frames, 1);
+    return 1;
+}
+
+//flat frames and fades: returns 1 when the frame was filled in without the quantizer
+static int fast_frame(Pipeline *p, const unsigned char *pixels, long long index, ProcessedFrame *frame) {
+    const PipelineConfig *cfg = p->cfg;
+    size_t pixel_count = (size_t)cfg->quant.scale_x * cfg->quant.scale_y;
+    long long reorder_slot = index % p->ring;
+    FrameLevels *levels = &p->levels[reorder_slot];
+    unsigned char *luma = p->luma + (pixel_count * reorder_slot);
+
+    frame_levels(pixels, pixel_count, luma, levels);
+    if (is_flat_frame(levels, cfg->fade_tolerance)) {
+        flat_frame(levels, pixel_count, frame);
+        atomic_fetch_add(&p->flat_frames, 1);
+        return 1;
+    }
+    if (!is_chained(p, index)) {
+        return 0;
+    }
+
+    //the previous frame is final (its indices stay in the reorder buffer even once written)
+    long long previous_slot = (index - 1) % p->ring;
+    const ProcessedFrame *previous = &p->frames[previous_slot];
+    const FrameLevels *anchor = &p->levels[previous_slot];
+    const unsigned char *anchor_luma = p->luma + (pixel_count * previous_slot);
+    //a flat frame's one color can't be scaled into a picture: the first frame lit after it (a
+    //fade in from black) gets a search and is the anchor the rest of the fade is scaled from
+    if ((previous->palette.count == 0) || is_flat_frame(anchor, cfg->fade_tolerance)) {
+        return 0;
+    }
+    float gain;
+    if (!fade_gain(anchor, anchor_luma, levels, luma, pixel_count, cfg->fade_tolerance, &gain) ||
+        (gain > FADE_MAX_GAIN)) {
+        return 0;
+    }
+    //the previous frame's palette is already scaled by the anchor's gain to it
+    fade_frame(previous, p->index_buffers + (pixel_count * previous_slot), gain / anchor->gain, pixel_count, frame);
+    *levels = *anchor;
+    levels->gain = gain;
+    memcpy(luma, anchor_luma, pixel_count);
+    atomic_fetch_add(&p->fade_frames, 1);
+    return 1;
+}
+
+//v2: counts one of the two frames frame 'index' needs (itself and its predecessor, frame 0
+//only itself), the second one to arrive encodes it and hands it to the writer
+static void encode_when_ready(Pipeline *p, long long index) {
+    const PipelineConfig *cfg = p->cfg;
+    size_t pixel_count = (size_t)cfg->quant.scale_x * cfg->quant.scale_y;
+    atomic_int *arrived = &p->arrivals[index % p->ring];
+    if (atomic_fetch_add(arrived, 1) + 1 < ((index == 0) ? 1 : 2)) {
+        return;
+    }
+    //the slot's next frame is a window away, it can't arrive before the writer has this one
+    atomic_store(arrived, 0);
+
+    ProcessedFrame *frame = &p->frames[index % p->ring];
+    const ProcessedFrame *previous = (index > 0) ? &p->frames[(index - 1) % p->ring] : NULL;
+    if (frame->indexed_pixels) {
+        frame->record_size = encode_indices(frame, previous, pixel_count, cfg->output->compress,
+                                            frame->record, frame->record + pixel_count, &frame->record_flags);
+    }
+    queue_push(&p->done, frame);
+}
+
+//quantizes one decoded frame into its reorder slot and hands it to the writer
+static void process_frame(Pipeline *p, Quantizer *quantizer, FrameSlot *slot) {
+    const PipelineConfig *cfg = p->cfg;
+    size_t pixel_count = (size_t)cfg->quant.scale_x * cfg->quant.scale_y;
+
+    //frames in flight are less than a window apart, so each one owns a reorder slot
+    long long index = slot->frame_index;
+    long long reorder_slot = index % p->ring;
+    ProcessedFrame *frame = &p->frames[reorder_slot];
+    frame->indexed_pixels = p->index_buffers + (pixel_count * reorder_slot);
+    frame->frame_number = (int)index + 1;
+    if (p->record_buffers) {
+        frame->record = p->record_buffers + (p->record_stride * reorder_slot);
+        frame->record_size = 0;
+    }
+
+    unsigned char *pixels = slot->failed ? NULL : slot->rgba;
+    unsigned char *loaded = NULL;
+    if (!slot->rgba) {
+        char filename[MAX_PATH_LENGTH];
+
+        sprintf(filename, "%s/%s_%d.png", cfg->frames_folder, cfg->frame_name, frame->frame_number);
+
+        //load the image
+        int width, height, channels;
+        loaded = stbi_load(filename, &width, &height, &channels, 4);
+        if (!loaded) {
+            fprintf(stderr, "failed to load image '%s'\n", filename);
+        }
+        pixels = loaded;
+    }
+
+    //the time from here to the finished remap is what the speed is tuned against
+    //(frames of a shot only remap, their palette search is timed by quantize_shot)
+    int speed = 0;
+    double quantize_start = 0.0;
+    if ((cfg->target_fps > 0.0) && !slot->shot) {
+        speed = speed_control_speed(&p->speed);
+        quantizer_set_speed(quantizer, speed);
+        quantize_start = omp_get_wtime();
+    }
+
+    //try the previous frame's palette first, then start from it, and only search for a new
+    //one from scratch at the head of a chain
+    const liq_palette *previous = is_chained(p, index) ? &p->frames[(index - 1) % p->ring].palette : NULL;
+    if (previous && (previous->count == 0)) {
+        previous = NULL;
+    }
+    int failed = !pixels;
+    if (!failed && slot->shot && (slot->shot->palette.count > 0)) {
+        //the shot's palette was searched once for all of its frames
+        failed = remap_frame(quantizer, pixels, &slot->shot->palette, frame);
+    }
+    else if (!failed && cfg->duplicates && duplicate_frame(p, pixels, index, frame)) {
+        //same picture as the previous frame, same result
+    }
+    else if (!failed && (cfg->fade_tolerance > 0) && fast_frame(p, pixels, index, frame)) {
+        //a flat frame or a fade, nothing to search or remap
+    }
+    else if (!failed && previous && (cfg->quant.reuse_quality > 0) && reuse_palette(quantizer, pixels, previous, frame)) {
+        atomic_fetch_add(&p->palettes_reused, 1);
+    }
+    else if (!failed && previous && (cfg->quant.warm_rounds > 0) &&
+        (previous->count * 4 >= (unsigned int)cfg->quant.num_colors)) {
+        //a handful of colors (a flat frame) is no starting point, those get a fresh search
+        failed = refine_frame(quantizer, pixels, previous, frame);
+        if (!failed) {
+            atomic_fetch_add(&p->palettes_refined, 1);
+        }
+    }
+    else if (!failed) {
+        failed = quantize_frame(quantizer, pixels, frame);
+    }
+    if (speed && !failed) {
+        speed_control_update(&p->speed, index, speed, 1, omp_get_wtime() - quantize_start);
+    }
+
+    if (failed) {
+        atomic_fetch_add(&p->errors, 1);
+        frame->indexed_pixels = NULL;
+        frame->palette.count = 0;
+    }
+    else {
+        //the writer only copies the packed palette out
+        pack_palette(frame->packed_palette, &frame->palette, cfg->output->num_colors);
+        if (!output_is_stream(cfg->output)) {
+            //frames have a fixed size, so this one can go straight to its final offset
+            if (output_write_frame_at(cfg->output, frame, index)) {
+                atomic_fetch_add(&p->errors, 1);
+            }
+            frame->indexed_pixels = NULL;
+        }
+    }
+    stbi_image_free(loaded);
+    quantizer_reset(quantizer);
+
+    //the palette is final, the next frame of the chain may use it
+    atomic_store(&p->quantized[reorder_slot], index);
+
+    //the rgba buffer can take the next decoded frame right away
+    queue_push(&p->free_slots, slot);
+    if (p->record_buffers) {
+        //this frame may complete its own pair and the next one's
+        encode_when_ready(p, index);
+        encode_when_ready(p, index + 1);
+    }
+    else {
+        queue_push(&p->done, frame);
+    }
+}
+
+static void quantize_stage(Pipeline *p) {
+    const PipelineConfig *cfg = p->cfg;
+    Quantizer quantizer;
+
+    if (quantizer_init(&quantizer, &cfg->quant)) {
+        atomic_store(&p->aborted, 1);
+    }
+
+    for (;;) {
+        FrameSlot *slot = queue_pop(&p->work);
+        if (!slot) {
+            break;
+        }
+        if (atomic_load(&p->aborted)) {
+            //keep taking frames until the decoders have stopped, so none of them waits on a full queue
+            queue_push(&p->free_slots, slot);
+            continue;
+        }
+        if (is_chained(p, slot->frame_index) && !claim_chained_frame(p, slot)) {
+            continue;
+        }
+
+        //work down the chain while the next frame is already waiting on this one
+        while (slot) {
+            long long next = slot->frame_index + 1;
+            process_frame(p, &quantizer, slot);
+            slot = is_chained(p, next) ? atomic_exchange(&p->parked[next % p->ring], NULL) : NULL;
+        }
+    }
+    quantizer_destroy(&quantizer);
+    atomic_fetch_sub(&p->workers_running, 1);
+}
+
+//scene palettes, first pass on a worker: load the frame if needed and sign it
+static void analyze_frame(Pipeline *p, Quantizer *quantizer, FrameSlot *slot) {
+    const PipelineConfig *cfg = p->cfg;
+    size_t pixel_count = (size_t)cfg->quant.scale_x * cfg->quant.scale_y;
+
+    if (cfg->decoder_type == DECODER_PNG) {
+        //the pixels have to last until the shot is remapped, so they go into the slot
+        char filename[MAX_PATH_LENGTH];
+        int width, height, channels;
+
+        sprintf(filename, "%s/%s_%d.png", cfg->frames_folder, cfg->frame_name, (int)slot->frame_index + 1);
+        unsigned char *loaded = stbi_load(filename, &width, &height, &channels, 4);
+        slot->failed = !loaded;
+        if (loaded) {
+            memcpy(slot->rgba, loaded, pixel_count * 4);
+            stbi_image_free(loaded);
+        }
+        else {
+            //still goes through its shot, process_frame counts it as an error
+            fprintf(stderr, "failed to load image '%s'\n", filename);
+        }
+        //the decoder's buffers came from the worker's arena
+        quantizer_reset(quantizer);
+    }
+    if (!slot->failed) {
+        scene_signature(slot->rgba, pixel_count, &p->signatures[(slot->frame_index % p->ring) * SCENE_BINS]);
+    }
+    queue_push(&p->analyzed, slot);
+}
+
+static void close_shot(Pipeline *p, Shot *shot) {
+    atomic_fetch_add(&p->scene_tasks, 1);
+    atomic_fetch_add(&p->shot_count, 1);
+    queue_push(&p->shot_queue, shot);
+}
+
+//scene palettes: takes the signed frames in order, cuts shots and fills their histograms
+static void scene_stage(Pipeline *p) {
+    const PipelineConfig *cfg = p->cfg;
+    size_t pixel_count = (size_t)cfg->quant.scale_x * cfg->quant.scale_y;
+    FrameSlot **arrived = calloc(p->ring, sizeof(FrameSlot *));
+    liq_attr *attr = histogram_attr_create(&cfg->quant);
+    unsigned int previous[SCENE_BINS];
+    int signed_frames = 0;
+    Shot *shot = NULL;
+    long long next = 0;
+    int spins = 0;
+
+    if (!arrived || !attr) {
+        fprintf(stderr, "failed to allocate memory for the scene detector\n");
+        atomic_store(&p->aborted, 1);
+    }
+
+    for (;;) {
+        if (atomic_load(&p->aborted)) {
+            //frames waiting in arrived are dropped with the rest of the run
+            break;
+        }
+        long long total = atomic_load(&p->total);
+        if ((total >= 0) && (next >= total)) {
+            break;
+        }
+
+        void *item;
+        if (!queue_try_pop(&p->analyzed, &item)) {
+            queue_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+        FrameSlot *slot = item;
+        arrived[slot->frame_index % p->ring] = slot;
+
+        //histograms are filled in frame order, so only the frames next in line go in
+        while ((slot = arrived[next % p->ring]) != NULL) {
+            const unsigned int *signature = &p->signatures[(next % p->ring) * SCENE_BINS];
+            arrived[next % p->ring] = NULL;
+
+            //a frame that failed to load has no signature and adds nothing to the histogram
+            if (shot && !slot->failed && signed_frames &&
+                (scene_difference(previous, signature, pixel_count) >= cfg->scene_cut)) {
+                close_shot(p, shot);
+                shot = NULL;
+            }
+            if (!shot) {
+                shot = queue_pop(&p->free_shots);
+                shot->hist = liq_histogram_create(attr);
+                shot->first = shot->last = NULL;
+                shot->frame_count = 0;
+            }
+            if (!slot->failed) {
+                memcpy(previous, signature, sizeof(previous));
+                signed_frames++;
+                if (!shot->hist || histogram_add_frame(attr, shot->hist, &cfg->quant, slot->rgba)) {
+                    fprintf(stderr, "failed to add frame %lld to its shot's histogram\n", next + 1);
+                }
+            }
+            slot->shot = shot;
+            slot->next_in_shot = NULL;
+            if (shot->last) {
+                shot->last->next_in_shot = slot;
+            } else {
+                shot->first = slot;
+            }
+            shot->last = slot;
+            shot->frame_count++;
+            next++;
+
+            //nothing of the shot is written before it closes, so it can't outgrow the window
+            if (shot->frame_count >= cfg->shot_frames) {
+                close_shot(p, shot);
+                shot = NULL;
+            }
+        }
+    }
+
+    if (shot) {
+        close_shot(p, shot);
+    }
+    atomic_store(&p->scene_done, 1);
+    if (attr) {
+        liq_attr_destroy(attr);
+    }
+    free(arrived);
+}
+
+//scene palettes: one palette search for the whole shot, then its frames go out for remapping
+static void quantize_shot(Pipeline *p, Quantizer *quantizer, Shot *shot) {
+    int speed = 0;
+    double search_start = 0.0;
+    if (p->cfg->target_fps > 0.0) {
+        speed = speed_control_speed(&p->speed);
+        quantizer_set_speed(quantizer, speed);
+        search_start = omp_get_wtime();
+    }
+    if (!shot->hist || quantize_histogram(quantizer, shot->hist, &shot->palette)) {
+        //each frame falls back to a palette of its own
+        shot->palette.count = 0;
+    }
+    else if (speed) {
+        //the search is shared, so each frame is charged its part of it
+        speed_control_update(&p->speed, shot->first->frame_index, speed, shot->frame_count, omp_get_wtime() - search_start);
+    }
+    if (shot->hist) {
+        liq_histogram_destroy(shot->hist);
+        shot->hist = NULL;
+    }
+    quantizer_reset(quantizer);
+
+    atomic_init(&shot->remaining, shot->frame_count);
+    atomic_fetch_add(&p->scene_tasks, shot->frame_count);
+    for (FrameSlot *slot = shot->first; slot; ) {
+        //the slot goes back to the decoders once remapped, read the link first
+        FrameSlot *next = slot->next_in_shot;
+        queue_push(&p->remaps, slot);
+        slot = next;
+    }
+    atomic_fetch_sub(&p->scene_tasks, 1);
+}
+
+//an aborted run hands a closed shot's frames back without searching or remapping them
+static void drop_shot(Pipeline *p, Shot *shot) {
+    if (shot->hist) {
+        liq_histogram_destroy(shot->hist);
+        shot->hist = NULL;
+    }
+    for (FrameSlot *slot = shot->first; slot; ) {
+        FrameSlot *next = slot->next_in_shot;
+        queue_push(&p->free_slots, slot);
+        slot = next;
+    }
+    queue_push(&p->free_shots, shot);
+    atomic_fetch_sub(&p->scene_tasks, 1);
+}
+
+static void scene_worker_stage(Pipeline *p) {
+    const PipelineConfig *cfg = p->cfg;
+    Quantizer quantizer;
+    int decoding = 1;
+    int spins = 0;
+
+    if (quantizer_init(&quantizer, &cfg->quant)) {
+        atomic_store(&p->aborted, 1);
+    }
+
+    for (;;) {
+        void *item;
+        int aborted = atomic_load(&p->aborted);
+
+        //finish what is furthest along first, that is what the writer waits for
+        if (queue_try_pop(&p->remaps, &item)) {
+            FrameSlot *slot = item;
+            Shot *shot = slot->shot;
+            if (aborted) {
+                queue_push(&p->free_slots, slot);
+            } else {
+                process_frame(p, &quantizer, slot);
+            }
+            if (atomic_fetch_sub(&shot->remaining, 1) == 1) {
+                queue_push(&p->free_shots, shot);
+            }
+            atomic_fetch_sub(&p->scene_tasks, 1);
+        }
+        else if (queue_try_pop(&p->shot_queue, &item)) {
+            if (aborted) {
+                drop_shot(p, item);
+            } else {
+                quantize_shot(p, &quantizer, item);
+            }
+        }
+        else if (decoding && queue_try_pop(&p->work, &item)) {
+            if (!item) {
+                decoding = 0;
+            } else if (aborted) {
+                //keep taking frames until the decoders have stopped
+                queue_push(&p->free_slots, item);
+            } else {
+                analyze_frame(p, &quantizer, item);
+            }
+        }
+        else if (!decoding && atomic_load(&p->scene_done) && (atomic_load(&p->scene_tasks) == 0)) {
+            break;
+        }
+        else {
+            queue_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+    }
+    quantizer_destroy(&quantizer);
+    atomic_fetch_sub(&p->workers_running, 1);
+}
+
+static void write_stage(Pipeline *p) {
+    const PipelineConfig *cfg = p->cfg;
+    ProcessedFrame **pending = p->pending;
+    long long written = 0;
+    int spins = 0;
+
+    for (;;) {
+        void *item;
+        if (!queue_try_pop(&p->done, &item)) {
+            if (atomic_load(&p->workers_running) > 0) {
+                queue_backoff(&spins);
+                continue;
+            }
+            //workers push before they leave, so once they are gone the queue is final
+            if (!queue_try_pop(&p->done, &item)) {
+                break;
+            }
+        }
+        spins = 0;
+
+        if (atomic_load(&p->aborted)) {
+            //the output is incomplete either way, the workers only need the queue emptied
+            continue;
+        }
+
+        ProcessedFrame *frame = item;
+        long long index = frame->frame_number - 1;
+        long long total = atomic_load(&p->total);
+        if ((total >= 0) && (index >= total)) {
+            //decoded past the end a single stream would have stopped at
+            continue;
+        }
+        pending[index % cfg->window] = frame;
+
+        //write every frame that is now next in line (direct modes only count them)
+        while ((frame = pending[written % cfg->window]) != NULL) {
+            pending[written % cfg->window] = NULL;
+            if (frame->indexed_pixels) {
+                if (output_write_frame(cfg->output, frame)) {
+                    fprintf(stderr, "failed to write frame %d\n", frame->frame_number);
+                    atomic_fetch_add(&p->errors, 1);
+                }
+                if (p->record_buffers) {
+                    p->delta_frames += (frame->record_flags & RECORD_DELTA) ? 1 : 0;
+                    p->rle_frames += (frame->record_flags & RECORD_RLE) ? 1 : 0;
+                    p->lz_frames += (frame->record_flags & RECORD_LZ) ? 1 : 0;
+                }
+            }
+            if (p->first_write_time < 0.0) {
+                p->first_write_time = omp_get_wtime() - p->start_time;
+            }
+            written++;
+            atomic_store(&p->written, written);
+
+            if (written % PROGRESS_INTERVAL == 0) {
+                print_progress(written, atomic_load(&p->total));
+            }
+        }
+    }
+
+    if (output_is_stream(cfg->output)) {
+        output_end_stream(cfg->output);
+    }
+    print_progress(written, written);
+}
+
+static void pipeline_free(Pipeline *p) {
+    free(p->slots);
+    free(p->rgba_buffers);
+    free(p->frames);
+    free(p->pending);
+    free(p->index_buffers);
+    free(p->levels);
+    free(p->luma);
+    free(p->hashes);
+    free(p->reference_rgba);
+    free(p->record_buffers);
+    free(p->arrivals);
+    free(p->quantized);
+    free(p->parked);
+    free(p->shots);
+    free(p->signatures);
+    queue_destroy(&p->free_slots);
+    queue_destroy(&p->work);
+    queue_destroy(&p->done);
+    queue_destroy(&p->analyzed);
+    queue_destroy(&p->shot_queue);
+    queue_destroy(&p->remaps);
+    queue_destroy(&p->free_shots);
+}
+
+int run_pipeline(const PipelineConfig *cfg, PipelineStats *stats) {
+    Pipeline p;
+    size_t rgba_frame_size = (size_t)cfg->quant.scale_x * cfg->quant.scale_y * 4;
+    int lanes = (cfg->decoder_type == DECODER_PNG) ? 1 : frame_stream_lanes(cfg->stream);
+    int scenes = (cfg->scene_cut > 0);
+    int queue_capacity = 2 * cfg->workers;
+    int slot_count = queue_capacity + cfg->workers + lanes;
+
+    if ((uses_chains(cfg) || scenes) && (slot_count <= cfg->window + lanes)) {
+        //parked frames and open shots hold on to their rgba, the window's worth of them must not starve the decoders
+        slot_count = cfg->window + lanes + 1;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.cfg = cfg;
+    p.lanes = lanes;
+    atomic_init(&p.written, 0);
+    atomic_init(&p.total, -1);
+    atomic_init(&p.next_png, 0);
+    atomic_init(&p.decoders_running, lanes);
+    atomic_init(&p.workers_running, cfg->workers);
+    atomic_init(&p.aborted, 0);
+    atomic_init(&p.errors, 0);
+    atomic_init(&p.palettes_reused, 0);
+    atomic_init(&p.palettes_refined, 0);
+    atomic_init(&p.flat_frames, 0);
+    atomic_init(&p.fade_frames, 0);
+    atomic_init(&p.duplicate_frames, 0);
+    atomic_init(&p.scene_tasks, 0);
+    atomic_init(&p.scene_done, 0);
+    atomic_init(&p.shot_count, 0);
+    if (cfg->target_fps > 0.0) {
+        speed_control_init(&p.speed, cfg->target_fps, cfg->workers);
+    }
+    p.first_write_time = -1.0;
+
+    //every rgba buffer the pipeline will ever use, recycled through free_slots
+    //(png frames only need one when they are kept around for a shot)
+    int rgba_slots = (cfg->decoder_type != DECODER_PNG) || scenes;
+    p.slots = malloc(slot_count * sizeof(FrameSlot));
+    if (rgba_slots) {
+        p.rgba_buffers = malloc(rgba_frame_size * slot_count);
+    }
+    p.ring = cfg->window + 1;
+    p.frames = malloc(p.ring * sizeof(ProcessedFrame));
+    p.pending = calloc(cfg->window, sizeof(ProcessedFrame *));
+    p.index_buffers = malloc((size_t)cfg->quant.scale_x * cfg->quant.scale_y * p.ring);
+    p.quantized = malloc(p.ring * sizeof(atomic_llong));
+    p.parked = malloc(p.ring * sizeof(*p.parked));
+    if (cfg->fade_tolerance > 0) {
+        p.levels = malloc(p.ring * sizeof(FrameLevels));
+        p.luma = malloc((size_t)cfg->quant.scale_x * cfg->quant.scale_y * p.ring);
+    }
+    if (cfg->duplicates) {
+        p.hashes = malloc(p.ring * sizeof(uint64_t));
+        p.reference_rgba = malloc(rgba_frame_size * p.ring);
+    }
+    if (cfg->output->format == FORMAT_V2) {
+        p.record_stride = (size_t)cfg->quant.scale_x * cfg->quant.scale_y * ((cfg->output->compress != COMPRESS_NONE) ? 2 : 1);
+        p.record_buffers = malloc(p.record_stride * p.ring);
+        p.arrivals = malloc(p.ring * sizeof(atomic_int));
+    }
+    if (scenes) {
+        //every open shot has a frame holding an rgba slot, so there are never more shots than slots
+        p.shots = malloc(slot_count * sizeof(Shot));
+        p.signatures = malloc(p.ring * SCENE_BINS * sizeof(unsigned int));
+    }
+    if (!p.slots || (rgba_slots && !p.rgba_buffers) || !p.frames || !p.pending || !p.index_buffers ||
+        !p.quantized || !p.parked || ((cfg->fade_tolerance > 0) && (!p.levels || !p.luma)) ||
+        (cfg->duplicates && (!p.hashes || !p.reference_rgba)) ||
+        ((cfg->output->format == FORMAT_V2) && (!p.record_buffers || !p.arrivals)) ||
+        (scenes && (!p.shots || !p.signatures)) ||
+        queue_init(&p.free_slots, slot_count) ||
+        queue_init(&p.work, queue_capacity + cfg->workers) ||
+        queue_init(&p.done, queue_capacity + cfg->workers) ||
+        (scenes && (queue_init(&p.analyzed, slot_count) || queue_init(&p.shot_queue, slot_count) ||
+                    queue_init(&p.remaps, slot_count) || queue_init(&p.free_shots, slot_count)))) {
+        printf("failed to allocate memory for the pipeline");
+        pipeline_free(&p);
+        return 1;
+    }
+    for (int i = 0; i < p.ring; i++) {
+        p.frames[i].palette.count = 0;
+        atomic_init(&p.quantized[i], -1);
+        if (p.arrivals) {
+            atomic_init(&p.arrivals[i], 0);
+        }
+        atomic_init(&p.parked[i], NULL);
+    }
+    for (int i = 0; i < slot_count; i++) {
+        p.slots[i].rgba = p.rgba_buffers ? (p.rgba_buffers + (rgba_frame_size * i)) : NULL;
+        p.slots[i].shot = NULL;
+        p.slots[i].failed = 0;
+        queue_push(&p.free_slots, &p.slots[i]);
+        if (scenes) {
+            queue_push(&p.free_shots, &p.shots[i]);
+        }
+    }
+
+    p.start_time = omp_get_wtime();
+
+    //threads [0, lanes) decode, the next one writes, in the stream modes the one after
+    //that flushes the output buffers, with scene palettes the next one cuts shots, the
+    //rest quantize
+    int flushers = output_is_stream(cfg->output);
+    int team_size = lanes + 1 + flushers + scenes + cfg->workers;
+    int started = 0;
+    omp_set_dynamic(0);
+    //workers open a team of their own for each frame with frame threads
+    omp_set_max_active_levels((cfg->quant.frame_threads > 1) ? 2 : 1);
+    #pragma omp parallel num_threads(team_size)
+    {
+        int id = omp_get_thread_num();
+        #pragma omp single
+        started = omp_get_num_threads();
+
+        if (started == team_size) {
+            if (id < lanes) {
+                decode_stage(&p, id);
+            } else if (id == lanes) {
+                write_stage(&p);
+            } else if (flushers && (id == lanes + 1)) {
+                output_flush_stage(cfg->output);
+            } else if (scenes && (id == lanes + 1 + flushers)) {
+                scene_stage(&p);
+            } else if (scenes) {
+                scene_worker_stage(&p);
+            } else {
+                quantize_stage(&p);
+            }
+        }
+    }
+    if (started != team_size) {
+        fprintf(stderr, "could not start %d pipeline threads (got %d)\n", team_size, started);
+    }
+
+    int aborted = atomic_load(&p.aborted);
+    stats->frames_written = atomic_load(&p.written);
+    stats->processing_errors = atomic_load(&p.errors);
+    stats->palettes_reused = atomic_load(&p.palettes_reused);
+    stats->palettes_refined = atomic_load(&p.palettes_refined);
+    stats->flat_frames = atomic_load(&p.flat_frames);
+    stats->fade_frames = atomic_load(&p.fade_frames);
+    stats->duplicate_frames = atomic_load(&p.duplicate_frames);
+    stats->delta_frames = p.delta_frames;
+    stats->rle_frames = p.rle_frames;
+    stats->lz_frames = p.lz_frames;
+    stats->shots = atomic_load(&p.shot_count);
+    stats->first_write_time = p.first_write_time;
+    for (int i = 0; i <= SPEED_MAX; i++) {
+        stats->frames_at_speed[i] = (cfg->target_fps > 0.0) ? atomic_load(&p.speed.frames_at[i]) : 0;
+    }
+
+    pipeline_free(&p);
+    return (started != team_size) || aborted;
+}
@@ -0,0 +1,65 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Decode -> quantize -> write pipeline
+ *--------------------------------------
+*/
+
+#ifndef FBIN_PIPELINE_H
+#define FBIN_PIPELINE_H
+
+#include <stdio.h>
+
+#include "decode.h"
+#include "output.h"
+#include "quantize.h"
+#include "speed.h"
+
+typedef struct {
+    //frame source: a stream (pipe / libav), or numbered pngs loaded by the workers
+    DecoderType decoder_type;
+    FrameStream *stream;
+    const char *frames_folder;
+    const char *frame_name;
+    int png_frames;
+
+    QuantizeOptions quant;
+    FrameOutput *output;        //direct write modes are written by the workers
+
+    int workers;            //quantization threads
+    int window;             //max frames between the writer and the newest decoded frame (reorder buffer size)
+    int chain_frames;       //with palette reuse or warm starts, frames that start a fresh palette every chain_frames frames
+    int scene_cut;          //share one palette per shot, cutting where this % of the colors change (0 = off)
+    int shot_frames;        //longest shot, shots are held whole so this must stay below the window
+    double target_fps;      //adapt libimagequant's speed to reach this many frames per second (0 = off)
+    int fade_tolerance;     //flat frames and fades within this many levels skip the quantizer (0 = off)
+    int duplicates;         //frames matching the previous one reuse its palette and indices (0 = off)
+    int duplicate_tolerance;    //per channel difference still counted as a match (0 = identical)
+} PipelineConfig;
+
+typedef struct {
+    long long frames_written;
+    int processing_errors;
+    long long palettes_reused;  //frames remapped with the previous frame's palette
+    long long palettes_refined; //frames whose palette was warm-started from the previous one
+    long long shots;            //shared palettes searched with scene palettes
+    long long flat_frames;      //one color frames
+    long long fade_frames;      //frames that kept the previous frame's indices under a scaled palette
+    long long duplicate_frames; //frames that matched the previous one
+    long long delta_frames;     //v2: frames written as runs against the previous one
+    long long rle_frames;       //v2: frames written rle compressed
+    long long lz_frames;        //v2: frames written lz compressed
+    double first_write_time;    //seconds from the start until the first frame hit the file
+    long long frames_at_speed[SPEED_MAX + 1];   //with a target fps, frames quantized at each speed
+} PipelineStats;
+
+//runs the decode stage (one thread per stream lane), the quantize workers and
+//one ordered writer at the same time, joined by bounded lock-free queues
+//with palette reuse, warm starts, fades or duplicates each frame of a chain waits for the one before
+//it, so the chains (not the frames) are what run in parallel
+//returns 1 when a stage couldn't start and the run stopped early, the output is left for the caller to close
+int run_pipeline(const PipelineConfig *cfg, PipelineStats *stats);
+
+#endif
@@ -0,0 +1,744 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Per-frame quantization
+ *--------------------------------------
+*/
+
+#include "quantize.h"
+#include "kmeans.h"
+#include "octree.h"
+#include "remap.h"
+#include "rgb555.h"
+
+#include <math.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//frames split into this many row stripes for the histogram, whatever the thread count,
+//so the merged histogram (and the palette) doesn't depend on it
+#define HISTOGRAM_STRIPES 16
+//k-means rounds after the median cut, most frames settle well before this
+#define KMEANS_ROUNDS 8
+
+typedef struct {
+    uint32_t color;     //rgba as it sits in memory
+    uint32_t count;     //0 = empty slot
+} ColorCount;
+
+//ordered dithering is a fixed offset per pixel, so it fits in front of the table lookup
+static int ordered_dither(const QuantizeOptions *opts) {
+    return (opts->dither_mode != DITHER_DIFFUSION) && (opts->dither_level > 0.0f);
+}
+
+//whether frames go through the table remap even when the backend has a remap of its own
+static int table_remap(const QuantizeOptions *opts) {
+    return (opts->dither_level == 0.0f) || ordered_dither(opts);
+}
+
+//undithered and ordered dithered remaps go through the rgb555 table instead of libimagequant's
+//search, only the 5 bits per channel the output keeps decide the nearest entry
+static int lut_remap(Quantizer *q, const unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame) {
+    const QuantizeOptions *opts = q->opts;
+    unsigned char *lut = arena_alloc(&q->arena, REMAP_LUT_SIZE);
+    if (!lut) {
+        fprintf(stderr, "failed to allocate the remap table for frame %d\n", frame->frame_number);
+        return 1;
+    }
+
+    //each thread builds a band of the table, then maps a band of rows once the whole table is there
+    #pragma omp parallel num_threads(opts->frame_threads) if (opts->frame_threads > 1)
+    {
+        int band = omp_get_thread_num(), bands = omp_get_num_threads();
+        remap_build_lut(palette, lut, band, bands);
+        #pragma omp barrier
+
+        int first_row = (opts->scale_y * band) / bands;
+        int last_row = (opts->scale_y * (band + 1)) / bands;
+        size_t offset = (size_t)first_row * opts->scale_x;
+        if (ordered_dither(opts)) {
+            remap_pixels_dithered(pixels, opts->scale_x, first_row, last_row, lut, &q->dither, frame->indexed_pixels);
+        }
+        else {
+            remap_pixels(pixels + (offset * 4), (size_t)(last_row - first_row) * opts->scale_x, lut, frame->indexed_pixels + offset);
+        }
+    }
+    if (palette != &frame->palette) {
+        memcpy(&frame->palette, palette, sizeof(liq_palette));
+    }
+    return 0;
+}
+
+//with --palette-sample the palette is searched from one pixel per cell of a grid over the
+//frame, width * height cells in all (about palette_sample % of the pixels)
+static void sample_size(const QuantizeOptions *opts, int *width, int *height) {
+    double scale = sqrt(opts->palette_sample / 100.0);
+    *width = (int)lround(opts->scale_x * scale);
+    *height = (int)lround(opts->scale_y * scale);
+    *width = (*width < 1) ? 1 : ((*width > opts->scale_x) ? opts->scale_x : *width);
+    *height = (*height < 1) ? 1 : ((*height > opts->scale_y) ? opts->scale_y : *height);
+}
+
+//gathers the sample, each cell gives the pixel at a fixed pseudo-random spot inside it, so
+//there is no stride pattern to alias with and still frames keep sampling the same pixels
+static void sample_frame(const QuantizeOptions *opts, const unsigned char *pixels, int width, int height, unsigned char *sample) {
+    for (int sy = 0; sy < height; sy++) {
+        for (int sx = 0; sx < width; sx++) {
+            uint32_t hash = ((uint32_t)sx * 0x9E3779B1u) ^ ((uint32_t)sy * 0x85EBCA77u);
+            hash ^= hash >> 15;
+            hash *= 0x2C1B3C6Du;
+            hash ^= hash >> 12;
+            int x = (int)((((int64_t)sx * 256 + (hash & 0xFF)) * opts->scale_x) / ((int64_t)width * 256));
+            int y = (int)((((int64_t)sy * 256 + ((hash >> 8) & 0xFF)) * opts->scale_y) / ((int64_t)height * 256));
+            memcpy(sample + (((size_t)sy * width + sx) * 4), pixels + (((size_t)y * opts->scale_x + x) * 4), 4);
+        }
+    }
+}
+
+//the pixels a palette is searched from: the frame itself, or its sample in the arena
+static unsigned char *search_pixels(Quantizer *q, unsigned char *pixels, int *width, int *height, int frame_number) {
+    const QuantizeOptions *opts = q->opts;
+    *width = opts->scale_x;
+    *height = opts->scale_y;
+    if (opts->palette_sample >= 100) {
+        return pixels;
+    }
+
+    sample_size(opts, width, height);
+    unsigned char *sample = arena_alloc(&q->arena, (size_t)*width * *height * 4);
+    if (!sample) {
+        fprintf(stderr, "failed to allocate the palette sample for frame %d\n", frame_number);
+        return NULL;
+    }
+    sample_frame(opts, pixels, *width, *height, sample);
+    return sample;
+}
+
+static size_t hash_slots(size_t pixel_count) {
+    size_t slots = 64;
+    while (slots < pixel_count * 2) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+static void count_color(ColorCount *table, size_t mask, uint32_t color, uint32_t count) {
+    size_t slot = ((color * 0x9E3779B1u) ^ (color >> 16)) & mask;
+    while (table[slot].count && (table[slot].color != color)) {
+        slot = (slot + 1) & mask;
+    }
+    table[slot].color = color;
+    table[slot].count += count;
+}
+
+//counts the exact colors of row stripes in parallel, merges the stripes in order and
+//hands the unique colors to libimagequant, the same histogram liq_image_quantize would
+//build minus its edge and noise weighting
+static liq_histogram *striped_histogram(Quantizer *q, const unsigned char *pixels, int width, int height, int frame_number) {
+    const QuantizeOptions *opts = q->opts;
+    size_t pixel_count = (size_t)width * height;
+    size_t stripe_slots = hash_slots((pixel_count / HISTOGRAM_STRIPES) + width);
+    size_t merged_slots = hash_slots(pixel_count);
+
+    ColorCount *stripes = arena_alloc(&q->arena, stripe_slots * HISTOGRAM_STRIPES * sizeof(ColorCount));
+    ColorCount *merged = arena_alloc(&q->arena, merged_slots * sizeof(ColorCount));
+    liq_histogram_entry *entries = arena_alloc(&q->arena, pixel_count * sizeof(liq_histogram_entry));
+    if (!stripes || !merged || !entries) {
+        fprintf(stderr, "failed to allocate the histogram for frame %d\n", frame_number);
+        return NULL;
+    }
+    memset(stripes, 0, stripe_slots * HISTOGRAM_STRIPES * sizeof(ColorCount));
+    memset(merged, 0, merged_slots * sizeof(ColorCount));
+
+    #pragma omp parallel for num_threads(opts->frame_threads) schedule(dynamic, 1)
+    for (int s = 0; s < HISTOGRAM_STRIPES; s++) {
+        ColorCount *table = stripes + (stripe_slots * s);
+        int first_row = (height * s) / HISTOGRAM_STRIPES;
+        int last_row = (height * (s + 1)) / HISTOGRAM_STRIPES;
+        for (size_t i = (size_t)first_row * width; i < (size_t)last_row * width; i++) {
+            uint32_t color;
+            memcpy(&color, pixels + (i * 4), 4);
+            count_color(table, stripe_slots - 1, color, 1);
+        }
+    }
+    for (size_t i = 0; i < stripe_slots * HISTOGRAM_STRIPES; i++) {
+        if (stripes[i].count) {
+            count_color(merged, merged_slots - 1, stripes[i].color, stripes[i].count);
+        }
+    }
+
+    int unique = 0;
+    for (size_t i = 0; i < merged_slots; i++) {
+        if (merged[i].count) {
+            const unsigned char *rgba = (const unsigned char *)&merged[i].color;
+            entries[unique].color = (liq_color){.r = rgba[0], .g = rgba[1], .b = rgba[2], .a = rgba[3]};
+            entries[unique].count = merged[i].count;
+            unique++;
+        }
+    }
+
+    liq_histogram *hist = liq_histogram_create(q->attr);
+    if (!hist) {
+        fprintf(stderr, "failed to create histogram for frame %d\n", frame_number);
+        return NULL;
+    }
+    if (liq_histogram_add_colors(hist, q->attr, entries, unique, 0) != LIQ_OK) {
+        fprintf(stderr, "failed to fill the histogram for frame %d\n", frame_number);
+        liq_histogram_destroy(hist);
+        return NULL;
+    }
+    return hist;
+}
+
+//bins a frame at the 5 bits per channel the output keeps, each occupied bin becomes one
+//histogram entry (bins holds RGB555_COLORS counters, entries as many entries)
+static int add_binned_colors(liq_attr *attr, liq_histogram *hist, const unsigned char *pixels, size_t pixel_count,
+                             uint32_t *bins, liq_histogram_entry *entries) {
+    memset(bins, 0, RGB555_COLORS * sizeof(uint32_t));
+    remap_histogram(pixels, pixel_count, bins);
+
+    int unique = 0;
+    for (int key = 0; key < RGB555_COLORS; key++) {
+        if (bins[key]) {
+            entries[unique].color = (liq_color){.r = RGB555_EXPAND(key >> 10), .g = RGB555_EXPAND((key >> 5) & 0x1F),
+                                                .b = RGB555_EXPAND(key & 0x1F), .a = 255};
+            entries[unique].count = bins[key];
+            unique++;
+        }
+    }
+    return (liq_histogram_add_colors(hist, attr, entries, unique, 0) != LIQ_OK);
+}
+
+static liq_histogram *binned_histogram(Quantizer *q, const unsigned char *pixels, size_t pixel_count, int frame_number) {
+    uint32_t *bins = arena_alloc(&q->arena, RGB555_COLORS * sizeof(uint32_t));
+    liq_histogram_entry *entries = arena_alloc(&q->arena, RGB555_COLORS * sizeof(liq_histogram_entry));
+    if (!bins || !entries) {
+        fprintf(stderr, "failed to allocate the histogram for frame %d\n", frame_number);
+        return NULL;
+    }
+
+    liq_histogram *hist = liq_histogram_create(q->attr);
+    if (!hist) {
+        fprintf(stderr, "failed to create histogram for frame %d\n", frame_number);
+        return NULL;
+    }
+    if (add_binned_colors(q->attr, hist, pixels, pixel_count, bins, entries)) {
+        fprintf(stderr, "failed to fill the histogram for frame %d\n", frame_number);
+        liq_histogram_destroy(hist);
+        return NULL;
+    }
+    return hist;
+}
+
+//libimagequant's palette search, on the pixels themselves or on a histogram built here
+//(binned or counted over stripes). *image is only created for the former, the caller
+//destroys whatever comes back in *image and *hist
+static liq_result *liq_search(Quantizer *q, unsigned char *pixels, int width, int height, int frame_number,
+                              liq_image **image, liq_histogram **hist) {
+    const QuantizeOptions *opts = q->opts;
+    liq_result *result = NULL;
+
+    *image = NULL;
+    *hist = NULL;
+    if ((opts->histogram == HISTOGRAM_RGB555) || (opts->frame_threads > 1)) {
+        *hist = (opts->histogram == HISTOGRAM_RGB555) ? binned_histogram(q, pixels, (size_t)width * height, frame_number)
+                                                      : striped_histogram(q, pixels, width, height, frame_number);
+        if (!*hist) {
+            return NULL;
+        }
+        if (liq_histogram_quantize(*hist, q->attr, &result) != LIQ_OK) {
+            fprintf(stderr, "quantization failed for frame %d\n", frame_number);
+            return NULL;
+        }
+        return result;
+    }
+
+    //create image
+    *image = liq_image_create_rgba(q->attr, pixels, width, height, 0);
+    if (!*image) {
+        fprintf(stderr, "failed to create image for frame %d\n", frame_number);
+        return NULL;
+    }
+
+    //quantize!
+    if (liq_image_quantize(*image, q->attr, &result) != LIQ_OK) {
+        fprintf(stderr, "quantization failed for frame %d\n", frame_number);
+        return NULL;
+    }
+    return result;
+}
+
+static void liq_search_done(liq_result *result, liq_image *image, liq_histogram *hist) {
+    if (result) {
+        liq_result_destroy(result);
+    }
+    if (image) {
+        liq_image_destroy(image);
+    }
+    if (hist) {
+        liq_histogram_destroy(hist);
+    }
+}
+
+static int liq_create(Quantizer *q) {
+    const QuantizeOptions *opts = q->opts;
+    q->attr = liq_attr_create_with_allocator(arena_thread_malloc, arena_thread_free);
+    if (!q->attr) {
+        fprintf(stderr, "failed to create quantization attributes\n");
+        return 1;
+    }
+    liq_set_max_colors(q->attr, opts->num_colors);
+    liq_set_quality(q->attr, opts->qual_min, opts->qual_max);
+    return 0;
+}
+
+static void liq_destroy(Quantizer *q) {
+    if (q->attr) {
+        liq_attr_destroy(q->attr);
+        q->attr = NULL;
+    }
+}
+
+static int liq_palette_search(Quantizer *q, unsigned char *pixels, int width, int height, liq_palette *palette, int frame_number) {
+    liq_image *image;
+    liq_histogram *hist;
+    liq_result *result = liq_search(q, pixels, width, height, frame_number, &image, &hist);
+    if (result) {
+        memcpy(palette, liq_get_palette(result), sizeof(liq_palette));
+    }
+    liq_search_done(result, image, hist);
+    return !result;
+}
+
+//a histogram of nothing but the palette's colors, all fixed, quantizes to exactly that palette
+//(*hist is left for the caller to destroy)
+static liq_result *fixed_palette(liq_attr *attr, const liq_palette *palette, liq_histogram **hist) {
+    liq_result *result = NULL;
+    *hist = liq_histogram_create(attr);
+    if (!*hist) {
+        return NULL;
+    }
+    for (unsigned int i = 0; i < palette->count; i++) {
+        liq_histogram_entry entry = {.color = palette->entries[i], .count = 1};
+        liq_histogram_add_fixed_color(*hist, palette->entries[i], 0);
+        liq_histogram_add_colors(*hist, attr, &entry, 1, 0);
+    }
+    if (liq_histogram_quantize(*hist, attr, &result) != LIQ_OK) {
+        return NULL;
+    }
+    return result;
+}
+
+//error diffusion with --frame-threads: each thread remaps a band of rows with a result and image
+//of its own, so the bands don't share libimagequant's state and the error doesn't carry from one
+//band into the next. only the first band runs on the worker's own thread (and arena), the others
+//go through malloc, so every band drops what it made before the team ends
+static int banded_remap(Quantizer *q, unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame) {
+    const QuantizeOptions *opts = q->opts;
+    unsigned char **rows = arena_alloc(&q->arena, opts->scale_y * sizeof(unsigned char *));
+    if (!rows) {
+        fprintf(stderr, "failed to allocate the rows of frame %d\n", frame->frame_number);
+        return 1;
+    }
+    for (int y = 0; y < opts->scale_y; y++) {
+        rows[y] = frame->indexed_pixels + ((size_t)y * opts->scale_x);
+    }
+
+    //every band quantizes the same fixed colors, so they agree on the palette's order
+    liq_palette remapped = *palette;
+    int failed = 0;
+    #pragma omp parallel num_threads(opts->frame_threads) reduction(|:failed)
+    {
+        int band = omp_get_thread_num(), bands = omp_get_num_threads();
+        int first_row = (opts->scale_y * band) / bands;
+        int last_row = (opts->scale_y * (band + 1)) / bands;
+        if (last_row > first_row) {
+            liq_histogram *hist;
+            liq_result *result = fixed_palette(q->attr, palette, &hist);
+            liq_image *image = NULL;
+            if (result) {
+                image = liq_image_create_rgba(q->attr, pixels + ((size_t)first_row * opts->scale_x * 4),
+                                              opts->scale_x, last_row - first_row, 0);
+            }
+            if (image) {
+                liq_set_dithering_level(result, opts->dither_level);
+                failed |= (liq_write_remapped_image_rows(result, image, rows + first_row) != LIQ_OK);
+                if (band == 0) {
+                    memcpy(&remapped, liq_get_palette(result), sizeof(liq_palette));
+                }
+            } else {
+                failed = 1;
+            }
+            liq_search_done(result, image, hist);
+        }
+    }
+    if (failed) {
+        fprintf(stderr, "palette remap failed for frame %d\n", frame->frame_number);
+        return 1;
+    }
+    memcpy(&frame->palette, &remapped, sizeof(liq_palette));
+    return 0;
+}
+
+//palette search and error diffusion in one go
+static int liq_quantize(Quantizer *q, unsigned char *pixels, ProcessedFrame *frame) {
+    const QuantizeOptions *opts = q->opts;
+    int width, height;
+    unsigned char *search = search_pixels(q, pixels, &width, &height, frame->frame_number);
+    if (!search) {
+        return 1;
+    }
+
+    liq_image *image;
+    liq_histogram *hist;
+    liq_result *result = liq_search(q, search, width, height, frame->frame_number, &image, &hist);
+    if (!result) {
+        liq_search_done(result, image, hist);
+        return 1;
+    }
+    liq_set_dithering_level(result, opts->dither_level);
+
+    //frame threads split the remap into bands, each with its own copy of the searched palette
+    if (opts->frame_threads > 1) {
+        memcpy(&frame->palette, liq_get_palette(result), sizeof(liq_palette));
+        liq_search_done(result, image, hist);
+        return banded_remap(q, pixels, &frame->palette, frame);
+    }
+
+    //error diffusion needs an image of the whole frame (and stays on this thread), a
+    //histogram or sample search doesn't have one yet
+    liq_image *frame_image = (search == pixels) ? image : NULL;
+    if (!frame_image) {
+        frame_image = liq_image_create_rgba(q->attr, pixels, opts->scale_x, opts->scale_y, 0);
+    }
+    if (!frame_image) {
+        fprintf(stderr, "failed to create image for frame %d\n", frame->frame_number);
+        liq_search_done(result, image, hist);
+        return 1;
+    }
+
+    //remap pixels to palette
+    liq_write_remapped_image(result, frame_image, frame->indexed_pixels, (size_t)opts->scale_x * opts->scale_y);
+
+    //copy palette (the remap refines it)
+    memcpy(&frame->palette, liq_get_palette(result), sizeof(liq_palette));
+
+    //clean up
+    if (frame_image != image) {
+        liq_image_destroy(frame_image);
+    }
+    liq_search_done(result, image, hist);
+    return 0;
+}
+
+static int liq_remap(Quantizer *q, unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame) {
+    const QuantizeOptions *opts = q->opts;
+    if (opts->frame_threads > 1) {
+        return banded_remap(q, pixels, palette, frame);
+    }
+
+    liq_histogram *hist;
+    liq_result *result = fixed_palette(q->attr, palette, &hist);
+    if (!result) {
+        fprintf(stderr, "palette remap failed for frame %d\n", frame->frame_number);
+        liq_search_done(NULL, NULL, hist);
+        return 1;
+    }
+    liq_set_dithering_level(result, opts->dither_level);
+
+    liq_image *image = liq_image_create_rgba(q->attr, pixels, opts->scale_x, opts->scale_y, 0);
+    if (!image) {
+        fprintf(stderr, "failed to create image for frame %d\n", frame->frame_number);
+        liq_search_done(result, NULL, hist);
+        return 1;
+    }
+    liq_write_remapped_image(result, image, frame->indexed_pixels, opts->scale_x * opts->scale_y);
+    memcpy(&frame->palette, liq_get_palette(result), sizeof(liq_palette));
+
+    liq_search_done(result, image, hist);
+    return 0;
+}
+
+//--palette-reuse: the frame's own histogram with every entry of 'palette' fixed and no room for
+//more, so libimagequant keeps the palette and measures how well the frame fits it the same way
+//it scores a fresh search. a frame that fits is remapped from that same result
+static int liq_reuse(Quantizer *q, unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame) {
+    const QuantizeOptions *opts = q->opts;
+    size_t pixel_count = (size_t)opts->scale_x * opts->scale_y;
+
+    //libimagequant wants 2 colors at least, a flat frame's palette is no candidate anyway
+    if (palette->count < 2) {
+        return 0;
+    }
+
+    liq_image *image = NULL;
+    liq_histogram *hist = NULL;
+    if ((opts->histogram == HISTOGRAM_RGB555) || (opts->frame_threads > 1)) {
+        hist = (opts->histogram == HISTOGRAM_RGB555) ? binned_histogram(q, pixels, pixel_count, frame->frame_number)
+                                                     : striped_histogram(q, pixels, opts->scale_x, opts->scale_y, frame->frame_number);
+    }
+    else {
+        image = liq_image_create_rgba(q->attr, pixels, opts->scale_x, opts->scale_y, 0);
+        hist = image ? liq_histogram_create(q->attr) : NULL;
+        if (hist && (liq_histogram_add_image(hist, q->attr, image) != LIQ_OK)) {
+            liq_histogram_destroy(hist);
+            hist = NULL;
+        }
+    }
+    if (!hist) {
+        liq_search_done(NULL, image, NULL);
+        return 0;
+    }
+    for (unsigned int i = 0; i < palette->count; i++) {
+        liq_histogram_add_fixed_color(hist, palette->entries[i], 0);
+    }
+
+    //a frame under -q's minimum fails here as well, it gets a search of its own
+    liq_result *result = NULL;
+    liq_set_max_colors(q->attr, palette->count);
+    liq_error err = liq_histogram_quantize(hist, q->attr, &result);
+    liq_set_max_colors(q->attr, opts->num_colors);
+    int reused = (err == LIQ_OK) && (liq_get_quantization_quality(result) >= opts->reuse_quality);
+
+    if (reused && table_remap(opts)) {
+        reused = !lut_remap(q, pixels, palette, frame);
+    }
+    else if (reused && (opts->frame_threads > 1)) {
+        reused = !banded_remap(q, pixels, palette, frame);
+    }
+    else if (reused) {
+        if (!image) {
+            image = liq_image_create_rgba(q->attr, pixels, opts->scale_x, opts->scale_y, 0);
+        }
+        if (image) {
+            liq_set_dithering_level(result, opts->dither_level);
+            liq_write_remapped_image(result, image, frame->indexed_pixels, pixel_count);
+            memcpy(&frame->palette, liq_get_palette(result), sizeof(liq_palette));
+        }
+        else {
+            fprintf(stderr, "failed to create image for frame %d\n", frame->frame_number);
+            reused = 0;
+        }
+    }
+    liq_search_done((err == LIQ_OK) ? result : NULL, image, hist);
+    return reused;
+}
+
+//the built-in backends all search from the rgb555 counts of the pixels they are given
+static uint32_t *count_bins(Quantizer *q, const unsigned char *pixels, size_t pixel_count, int frame_number) {
+    uint32_t *bins = arena_alloc(&q->arena, RGB555_COLORS * sizeof(uint32_t));
+    if (!bins) {
+        fprintf(stderr, "failed to allocate the histogram for frame %d\n", frame_number);
+        return NULL;
+    }
+    memset(bins, 0, RGB555_COLORS * sizeof(uint32_t));
+    remap_histogram(pixels, pixel_count, bins);
+    return bins;
+}
+
+static int median_cut_search(Quantizer *q, unsigned char *pixels, int width, int height, liq_palette *palette, int frame_number) {
+    uint32_t *bins = count_bins(q, pixels, (size_t)width * height, frame_number);
+    if (!bins || rgb555_median_cut(&q->arena, bins, q->opts->num_colors, palette)) {
+        fprintf(stderr, "quantization failed for frame %d\n", frame_number);
+        return 1;
+    }
+    return 0;
+}
+
+static int octree_search(Quantizer *q, unsigned char *pixels, int width, int height, liq_palette *palette, int frame_number) {
+    uint32_t *bins = count_bins(q, pixels, (size_t)width * height, frame_number);
+    if (!bins || octree_palette(&q->arena, bins, q->opts->num_colors, palette)) {
+        fprintf(stderr, "quantization failed for frame %d\n", frame_number);
+        return 1;
+    }
+    return 0;
+}
+
+//median cut gets the entries close, k-means then pulls each one to the middle of its colors
+static int kmeans_search(Quantizer *q, unsigned char *pixels, int width, int height, liq_palette *palette, int frame_number) {
+    uint32_t *bins = count_bins(q, pixels, (size_t)width * height, frame_number);
+    if (!bins || rgb555_median_cut(&q->arena, bins, q->opts->num_colors, palette) ||
+        kmeans_refine(&q->arena, bins, KMEANS_ROUNDS, palette)) {
+        fprintf(stderr, "quantization failed for frame %d\n", frame_number);
+        return 1;
+    }
+    return 0;
+}
+
+static const QuantizerBackend backends[] = {
+    [QUANTIZER_LIQ] = {"liq", liq_create, liq_destroy, liq_palette_search, liq_quantize, liq_remap, liq_reuse},
+    [QUANTIZER_RGB555] = {"rgb555", NULL, NULL, median_cut_search, NULL, NULL, NULL},
+    [QUANTIZER_OCTREE] = {"octree", NULL, NULL, octree_search, NULL, NULL, NULL},
+    [QUANTIZER_KMEANS] = {"kmeans", NULL, NULL, kmeans_search, NULL, NULL, NULL}
+};
+
+int parse_quantizer_type(const char *str, QuantizerType *type) {
+    for (int i = 0; i < (int)(sizeof(backends) / sizeof(backends[0])); i++) {
+        if (strcmp(str, backends[i].name) == 0) {
+            *type = (QuantizerType)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int parse_histogram_input(const char *str, HistogramInput *input) {
+    if (strcmp(str, "image") == 0) {
+        *input = HISTOGRAM_IMAGE;
+    } else if (strcmp(str, "rgb555") == 0) {
+        *input = HISTOGRAM_RGB555;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+int quantizer_init(Quantizer *q, const QuantizeOptions *opts) {
+    q->opts = opts;
+    q->backend = &backends[opts->type];
+    q->attr = NULL;
+    q->speed = 0;
+    arena_init(&q->arena);
+    if (ordered_dither(opts)) {
+        dither_tile_init(&q->dither, opts->dither_mode, opts->dither_level, opts->num_colors);
+    }
+
+    //backend state outlives every frame, so it is created before the arena is in use
+    arena_set_thread(NULL);
+    if (q->backend->create && q->backend->create(q)) {
+        return 1;
+    }
+
+    arena_set_thread(&q->arena);
+    return 0;
+}
+
+void quantizer_destroy(Quantizer *q) {
+    //backend state was allocated by malloc, so free has to reach free again
+    arena_set_thread(NULL);
+    if (q->backend->destroy) {
+        q->backend->destroy(q);
+    }
+    arena_destroy(&q->arena);
+}
+
+void quantizer_set_speed(Quantizer *q, int speed) {
+    if (q->attr && (speed != q->speed)) {
+        liq_set_speed(q->attr, speed);
+        q->speed = speed;
+    }
+}
+
+void quantizer_reset(Quantizer *q) {
+    arena_reset(&q->arena);
+}
+
+int quantize_frame(Quantizer *q, unsigned char *pixels, ProcessedFrame *frame) {
+    const QuantizerBackend *backend = q->backend;
+    if (backend->quantize && !table_remap(q->opts)) {
+        return backend->quantize(q, pixels, frame);
+    }
+
+    int width, height;
+    unsigned char *search = search_pixels(q, pixels, &width, &height, frame->frame_number);
+    if (!search || backend->palette(q, search, width, height, &frame->palette, frame->frame_number)) {
+        return 1;
+    }
+    return lut_remap(q, pixels, &frame->palette, frame);
+}
+
+int remap_frame(Quantizer *q, unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame) {
+    const QuantizerBackend *backend = q->backend;
+    if (backend->remap && !table_remap(q->opts)) {
+        return backend->remap(q, pixels, palette, frame);
+    }
+    return lut_remap(q, pixels, palette, frame);
+}
+
+int reuse_palette(Quantizer *q, unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame) {
+    const QuantizerBackend *backend = q->backend;
+    return backend->reuse && backend->reuse(q, pixels, palette, frame);
+}
+
+int refine_frame(Quantizer *q, unsigned char *pixels, const liq_palette *seed, ProcessedFrame *frame) {
+    int width, height;
+    unsigned char *search = search_pixels(q, pixels, &width, &height, frame->frame_number);
+    if (!search) {
+        return 1;
+    }
+    uint32_t *bins = count_bins(q, search, (size_t)width * height, frame->frame_number);
+    if (!bins) {
+        return 1;
+    }
+
+    //consecutive frames share most of their colors, so this usually settles in 1-3 rounds
+    //a seed with fewer entries (a simple frame, a small sample) is padded with copies of its first one,
+    //which pick up no colors and get spread over the worst served ones instead
+    liq_palette palette = *seed;
+    for (; palette.count < (unsigned int)q->opts->num_colors; palette.count++) {
+        palette.entries[palette.count] = palette.entries[0];
+    }
+    if (kmeans_refine(&q->arena, bins, q->opts->warm_rounds, &palette)) {
+        fprintf(stderr, "failed to refine the palette of frame %d\n", frame->frame_number);
+        return 1;
+    }
+    return remap_frame(q, pixels, &palette, frame);
+}
+
+liq_attr *histogram_attr_create(const QuantizeOptions *opts) {
+    liq_attr *attr = liq_attr_create();
+    if (!attr) {
+        fprintf(stderr, "failed to create histogram attributes\n");
+        return NULL;
+    }
+    liq_set_max_colors(attr, opts->num_colors);
+    liq_set_quality(attr, opts->qual_min, opts->qual_max);
+    return attr;
+}
+
+int histogram_add_frame(liq_attr *attr, liq_histogram *hist, const QuantizeOptions *opts, unsigned char *pixels) {
+    int width = opts->scale_x, height = opts->scale_y;
+    unsigned char *sample = NULL;
+    if (opts->palette_sample < 100) {
+        sample_size(opts, &width, &height);
+        sample = malloc((size_t)width * height * 4);
+        if (!sample) {
+            return 1;
+        }
+        sample_frame(opts, pixels, width, height, sample);
+        pixels = sample;
+    }
+
+    int err = 1;
+    if (opts->histogram == HISTOGRAM_RGB555) {
+        uint32_t *bins = malloc(RGB555_COLORS * sizeof(uint32_t));
+        liq_histogram_entry *entries = malloc(RGB555_COLORS * sizeof(liq_histogram_entry));
+        err = !bins || !entries || add_binned_colors(attr, hist, pixels, (size_t)width * height, bins, entries);
+        free(bins);
+        free(entries);
+    }
+    else {
+        liq_image *image = liq_image_create_rgba(attr, pixels, width, height, 0);
+        if (image) {
+            err = (liq_histogram_add_image(hist, attr, image) != LIQ_OK);
+            liq_image_destroy(image);
+        }
+    }
+    free(sample);
+    return err;
+}
+
+int quantize_histogram(Quantizer *q, liq_histogram *hist, liq_palette *palette) {
+    liq_result *result;
+    if (liq_histogram_quantize(hist, q->attr, &result) != LIQ_OK) {
+        return 1;
+    }
+    memcpy(palette, liq_get_palette(result), sizeof(liq_palette));
+    liq_result_destroy(result);
+    return 0;
+}
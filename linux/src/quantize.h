@@ -0,0 +1,117 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Per-frame quantization
+ *--------------------------------------
+*/
+
+#ifndef FBIN_QUANTIZE_H
+#define FBIN_QUANTIZE_H
+
+#include "../include/libimagequant.h"
+#include "arena.h"
+#include "dither.h"
+
+typedef enum {
+    QUANTIZER_LIQ,      //libimagequant
+    QUANTIZER_RGB555,   //built-in median cut in the 15-bit space the output keeps
+    QUANTIZER_OCTREE,   //built-in octree, same space
+    QUANTIZER_KMEANS    //median cut refined by k-means, same space
+} QuantizerType;
+
+typedef enum {
+    HISTOGRAM_IMAGE,    //libimagequant reads the full rgba frame
+    HISTOGRAM_RGB555    //only the occupied rgb555 bins and their counts are handed over
+} HistogramInput;
+
+typedef struct {
+    QuantizerType type;
+    HistogramInput histogram;
+    int scale_x, scale_y;
+    int num_colors;
+    int qual_min, qual_max;
+    float dither_level;
+    DitherMode dither_mode; //diffusion runs inside libimagequant, the ordered modes in the remap table
+    int reuse_quality;      //keep the previous frame's palette while the remap reaches this quality (0 = off)
+    int frame_threads;      //threads sharing each frame's histogram and remap (1 = off)
+    int palette_sample;     //% of the pixels the palette is searched from (100 = all of them)
+    int warm_rounds;        //k-means rounds from the previous frame's palette in place of a search (0 = off)
+} QuantizeOptions;
+
+typedef struct {
+    unsigned char *indexed_pixels;
+    liq_palette palette;
+    unsigned char packed_palette[2 * 256];  //the palette as the player reads it (rgb1555), packed by the worker
+    int frame_number;
+    unsigned char *record;      //v2 output: the indices part of the frame's record (see encode.h)
+    size_t record_size;
+    int record_flags;
+} ProcessedFrame;
+
+int parse_quantizer_type(const char *str, QuantizerType *type);
+int parse_histogram_input(const char *str, HistogramInput *input);
+
+typedef struct Quantizer Quantizer;
+
+//one palette search method. create/destroy set up and drop the per-thread state (either may
+//be NULL), palette searches a palette from the rgba pixels it is given (the frame or a sample
+//of it, width * height). quantize and remap may do what palette + the table remap would do
+//in their own way (libimagequant's error diffusion), when they are NULL or the table remap
+//is asked for (no dithering, ordered dithering) the table is used
+//each returns 0 on success, prints the reason and returns 1 on failure. reuse (may be NULL)
+//remaps the frame onto a palette only when that keeps opts->reuse_quality, returning 1 if it did
+typedef struct {
+    const char *name;   //--quantizer value
+    int (*create)(Quantizer *q);
+    void (*destroy)(Quantizer *q);
+    int (*palette)(Quantizer *q, unsigned char *pixels, int width, int height, liq_palette *palette, int frame_number);
+    int (*quantize)(Quantizer *q, unsigned char *pixels, ProcessedFrame *frame);
+    int (*remap)(Quantizer *q, unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame);
+    int (*reuse)(Quantizer *q, unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame);
+} QuantizerBackend;
+
+//per-thread quantization state: the backend's state (for libimagequant one configured
+//liq_attr, reused for every frame) whose per-frame allocations come from the thread's arena
+//and are dropped after each frame
+struct Quantizer {
+    const QuantizeOptions *opts;
+    const QuantizerBackend *backend;
+    liq_attr *attr;         //libimagequant only
+    Arena arena;
+    DitherTile dither;      //built once, only used by the ordered modes
+    int speed;              //liq_set_speed value, 0 until it is first set
+};
+
+//must be called on the thread that will use the quantizer, it claims the thread's arena
+int quantizer_init(Quantizer *q, const QuantizeOptions *opts);
+void quantizer_destroy(Quantizer *q);
+//libimagequant's speed (1-10) for the following palette searches (other backends ignore it)
+void quantizer_set_speed(Quantizer *q, int speed);
+
+//quantizes one rgba frame into frame->indexed_pixels (scale_x * scale_y bytes, owned by the caller)
+//returns 0 on success, prints the reason and returns 1 on failure
+int quantize_frame(Quantizer *q, unsigned char *pixels, ProcessedFrame *frame);
+//remaps a frame onto an existing palette (no palette search), copying it to frame->palette
+//returns 0 on success, prints the reason and returns 1 on failure
+int remap_frame(Quantizer *q, unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame);
+//warm start: moves 'seed' (the previous frame's palette) onto this frame's colors with up to
+//opts->warm_rounds k-means rounds instead of searching a palette from scratch, then remaps
+int refine_frame(Quantizer *q, unsigned char *pixels, const liq_palette *seed, ProcessedFrame *frame);
+//palette reuse: remaps a frame onto the previous frame's palette when libimagequant rates the
+//fit at opts->reuse_quality or better. returns 1 when it did, 0 when the frame needs a palette of
+//its own (the palette doesn't fit, or the backend can't tell)
+int reuse_palette(Quantizer *q, unsigned char *pixels, const liq_palette *palette, ProcessedFrame *frame);
+
+//histograms that span several frames (a shot) outlive any one frame, so they are
+//filled through a plain malloc attr configured like the quantizers
+liq_attr *histogram_attr_create(const QuantizeOptions *opts);
+int histogram_add_frame(liq_attr *attr, liq_histogram *hist, const QuantizeOptions *opts, unsigned char *pixels);
+//searches the palette for a filled histogram, the histogram stays valid
+int quantize_histogram(Quantizer *q, liq_histogram *hist, liq_palette *palette);
+
+//drops everything the last frame allocated, including stb_image buffers loaded on this thread
+void quantizer_reset(Quantizer *q);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Bounded lock-free queue
+ *--------------------------------------
+*/
+
+#include "queue.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+int queue_init(FrameQueue *q, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    q->cells = malloc(size * sizeof(QueueCell));
+    if (!q->cells) {
+        return 1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&q->cells[i].sequence, i);
+        q->cells[i].data = NULL;
+    }
+    q->mask = size - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    return 0;
+}
+
+void queue_destroy(FrameQueue *q) {
+    free(q->cells);
+    q->cells = NULL;
+}
+
+int queue_try_push(FrameQueue *q, void *data) {
+    QueueCell *cell;
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            //the cell is free for this lap, claim it
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->data = data;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return 1;
+}
+
+int queue_try_pop(FrameQueue *q, void **data) {
+    QueueCell *cell;
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            //the cell holds an item for this lap, take it
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *data = cell->data;
+    atomic_store_explicit(&cell->sequence, pos + q->mask + 1, memory_order_release);
+    return 1;
+}
+
+void queue_push(FrameQueue *q, void *data) {
+    int spins = 0;
+    while (!queue_try_push(q, data)) {
+        queue_backoff(&spins);
+    }
+}
+
+void *queue_pop(FrameQueue *q) {
+    void *data;
+    int spins = 0;
+    while (!queue_try_pop(q, &data)) {
+        queue_backoff(&spins);
+    }
+    return data;
+}
+
+void queue_backoff(int *spins) {
+    //short waits stay on the core, long ones (a stage waiting on ffmpeg) sleep
+    if (*spins < 64) {
+        (*spins)++;
+    } else if (*spins < 128) {
+        (*spins)++;
+        sched_yield();
+    } else {
+        struct timespec pause = {0, 200000};
+        nanosleep(&pause, NULL);
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Bounded lock-free queue
+ *--------------------------------------
+*/
+
+#ifndef FBIN_QUEUE_H
+#define FBIN_QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+//multi-producer / multi-consumer ring of pointers, each cell carries a sequence
+//number so producers and consumers only ever contend on one atomic counter
+typedef struct {
+    atomic_size_t sequence;
+    void *data;
+} QueueCell;
+
+typedef struct {
+    QueueCell *cells;
+    size_t mask;
+    _Alignas(64) atomic_size_t enqueue_pos;
+    _Alignas(64) atomic_size_t dequeue_pos;
+} FrameQueue;
+
+//capacity is rounded up to a power of two
+int queue_init(FrameQueue *q, size_t capacity);
+void queue_destroy(FrameQueue *q);
+
+//return 1 on success, 0 when the queue is full / empty
+int queue_try_push(FrameQueue *q, void *data);
+int queue_try_pop(FrameQueue *q, void **data);
+
+//block (spin, then sleep) until there is room / an item
+void queue_push(FrameQueue *q, void *data);
+void *queue_pop(FrameQueue *q);
+
+//one step of the spin-then-sleep wait used by the blocking calls
+void queue_backoff(int *spins);
+
+#endif
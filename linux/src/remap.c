@@ -0,0 +1,369 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: rgb555 lookup table remapping
+ *--------------------------------------
+*/
+
+#include "remap.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef enum {
+    KERNEL_SCALAR,
+    KERNEL_SSE4,
+    KERNEL_AVX2
+} RemapKernel;
+
+static RemapKernel pick_kernel(void) {
+    //the kernels are compiled with target attributes, so one binary runs everywhere
+    if (__builtin_cpu_supports("avx2")) {
+        return KERNEL_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return KERNEL_SSE4;
+    }
+    return KERNEL_SCALAR;
+}
+
+//palette channels at 5 bits, as the writer stores them
+static int palette_channels(const liq_palette *palette, int16_t *pr, int16_t *pg, int16_t *pb) {
+    int count = (int)palette->count;
+    for (int j = 0; j < count; j++) {
+        pr[j] = palette->entries[j].r >> 3;
+        pg[j] = palette->entries[j].g >> 3;
+        pb[j] = palette->entries[j].b >> 3;
+    }
+    return count;
+}
+
+//the nearest kernels fill out[i] for i in [first, last), with the key i itself (table
+//build) or keys[i] (a list of colors)
+static void nearest_scalar(const int16_t *pr, const int16_t *pg, const int16_t *pb, int count,
+                           const uint16_t *keys, int first, int last, unsigned char *out) {
+    for (int i = first; i < last; i++) {
+        int key = keys ? keys[i] : i;
+        int r = key >> 10, g = (key >> 5) & 0x1F, b = key & 0x1F;
+        int best = 0, best_dist = 1 << 30;
+        for (int j = 0; j < count; j++) {
+            int dr = r - pr[j], dg = g - pg[j], db = b - pb[j];
+            int dist = (dr * dr) + (dg * dg) + (db * db);
+            if (dist < best_dist) {
+                best_dist = dist;
+                best = j;
+            }
+        }
+        out[i] = (unsigned char)best;
+    }
+}
+
+//8 keys per step, one 16-bit lane each (3 * 31^2 fits easily)
+__attribute__((target("sse4.1")))
+static void nearest_sse4(const int16_t *pr, const int16_t *pg, const int16_t *pb, int count,
+                         const uint16_t *keys, int first, int last, unsigned char *out) {
+    const __m128i lanes = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    int i = first;
+    for (; i + 8 <= last; i += 8) {
+        __m128i key = keys ? _mm_loadu_si128((const __m128i *)(keys + i)) : _mm_add_epi16(_mm_set1_epi16((short)i), lanes);
+        __m128i r = _mm_srli_epi16(key, 10);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(key, 5), _mm_set1_epi16(0x1F));
+        __m128i b = _mm_and_si128(key, _mm_set1_epi16(0x1F));
+        __m128i best_dist = _mm_set1_epi16(0x7FFF);
+        __m128i best = _mm_setzero_si128();
+
+        for (int j = 0; j < count; j++) {
+            __m128i dr = _mm_sub_epi16(r, _mm_set1_epi16(pr[j]));
+            __m128i dg = _mm_sub_epi16(g, _mm_set1_epi16(pg[j]));
+            __m128i db = _mm_sub_epi16(b, _mm_set1_epi16(pb[j]));
+            __m128i dist = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dr, dr), _mm_mullo_epi16(dg, dg)), _mm_mullo_epi16(db, db));
+            __m128i closer = _mm_cmplt_epi16(dist, best_dist);
+            best_dist = _mm_min_epi16(dist, best_dist);
+            best = _mm_blendv_epi8(best, _mm_set1_epi16((short)j), closer);
+        }
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(best, best));
+    }
+    nearest_scalar(pr, pg, pb, count, keys, i, last, out);
+}
+
+//16 keys per step
+__attribute__((target("avx2")))
+static void nearest_avx2(const int16_t *pr, const int16_t *pg, const int16_t *pb, int count,
+                         const uint16_t *keys, int first, int last, unsigned char *out) {
+    const __m256i lanes = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    int i = first;
+    for (; i + 16 <= last; i += 16) {
+        __m256i key = keys ? _mm256_loadu_si256((const __m256i *)(keys + i)) : _mm256_add_epi16(_mm256_set1_epi16((short)i), lanes);
+        __m256i r = _mm256_srli_epi16(key, 10);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(key, 5), _mm256_set1_epi16(0x1F));
+        __m256i b = _mm256_and_si256(key, _mm256_set1_epi16(0x1F));
+        __m256i best_dist = _mm256_set1_epi16(0x7FFF);
+        __m256i best = _mm256_setzero_si256();
+
+        for (int j = 0; j < count; j++) {
+            __m256i dr = _mm256_sub_epi16(r, _mm256_set1_epi16(pr[j]));
+            __m256i dg = _mm256_sub_epi16(g, _mm256_set1_epi16(pg[j]));
+            __m256i db = _mm256_sub_epi16(b, _mm256_set1_epi16(pb[j]));
+            __m256i dist = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dr, dr), _mm256_mullo_epi16(dg, dg)), _mm256_mullo_epi16(db, db));
+            __m256i closer = _mm256_cmpgt_epi16(best_dist, dist);
+            best_dist = _mm256_min_epi16(dist, best_dist);
+            best = _mm256_blendv_epi8(best, _mm256_set1_epi16((short)j), closer);
+        }
+        //packus works per 128-bit half, the permute puts the 16 bytes back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(best, best), 0xD8);
+        _mm_storeu_si128((__m128i *)(out + i), _mm256_castsi256_si128(packed));
+    }
+    nearest_scalar(pr, pg, pb, count, keys, i, last, out);
+}
+
+static void nearest(const liq_palette *palette, const uint16_t *keys, int first, int last, unsigned char *out) {
+    int16_t pr[256], pg[256], pb[256];
+    int count = palette_channels(palette, pr, pg, pb);
+
+    switch (pick_kernel()) {
+        case KERNEL_AVX2:
+            nearest_avx2(pr, pg, pb, count, keys, first, last, out);
+            break;
+        case KERNEL_SSE4:
+            nearest_sse4(pr, pg, pb, count, keys, first, last, out);
+            break;
+        default:
+            nearest_scalar(pr, pg, pb, count, keys, first, last, out);
+            break;
+    }
+}
+
+void remap_build_lut(const liq_palette *palette, unsigned char *lut, int band, int bands) {
+    //band edges stay multiples of 16 keys, the width of the widest kernel step
+    int first = (int)(((32768LL * band) / bands) & ~15LL);
+    int last = (int)(((32768LL * (band + 1)) / bands) & ~15LL);
+
+    nearest(palette, NULL, first, last, lut);
+    if (band == bands - 1) {
+        memset(lut + 32768, 0, REMAP_LUT_SIZE - 32768);
+    }
+}
+
+static void remap_pixels_scalar(const unsigned char *rgba, size_t pixel_count, const unsigned char *lut, unsigned char *indexed) {
+    for (size_t i = 0; i < pixel_count; i++) {
+        const unsigned char *px = rgba + (i * 4);
+        indexed[i] = lut[((px[0] >> 3) << 10) | ((px[1] >> 3) << 5) | (px[2] >> 3)];
+    }
+}
+
+//rgb555 key of four rgba pixels, one per 32-bit lane
+__attribute__((target("sse4.1")))
+static __m128i keys_sse4(__m128i px) {
+    __m128i r = _mm_and_si128(_mm_srli_epi32(px, 3), _mm_set1_epi32(0x1F));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(px, 11), _mm_set1_epi32(0x1F));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(px, 19), _mm_set1_epi32(0x1F));
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 10), _mm_slli_epi32(g, 5)), b);
+}
+
+//sse4 has no gather, the keys are built 4 at a time and looked up one by one
+__attribute__((target("sse4.1")))
+static void remap_pixels_sse4(const unsigned char *rgba, size_t pixel_count, const unsigned char *lut, unsigned char *indexed) {
+    size_t i = 0;
+    for (; i + 4 <= pixel_count; i += 4) {
+        __m128i keys = keys_sse4(_mm_loadu_si128((const __m128i *)(rgba + (i * 4))));
+        indexed[i + 0] = lut[_mm_extract_epi32(keys, 0)];
+        indexed[i + 1] = lut[_mm_extract_epi32(keys, 1)];
+        indexed[i + 2] = lut[_mm_extract_epi32(keys, 2)];
+        indexed[i + 3] = lut[_mm_extract_epi32(keys, 3)];
+    }
+    remap_pixels_scalar(rgba + (i * 4), pixel_count - i, lut, indexed + i);
+}
+
+//8 pixels per step: keys in 32-bit lanes, one gather, then the low byte of each lane
+__attribute__((target("avx2")))
+static void remap_pixels_avx2(const unsigned char *rgba, size_t pixel_count, const unsigned char *lut, unsigned char *indexed) {
+    const __m256i mask = _mm256_set1_epi32(0x1F);
+    const __m256i low_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                               0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 8 <= pixel_count; i += 8) {
+        __m256i px = _mm256_loadu_si256((const __m256i *)(rgba + (i * 4)));
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(px, 3), mask);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 11), mask);
+        __m256i b = _mm256_and_si256(_mm256_srli_epi32(px, 19), mask);
+        __m256i keys = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 10), _mm256_slli_epi32(g, 5)), b);
+
+        __m256i entries = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *)lut, keys, 1), low_bytes);
+        uint32_t lo = (uint32_t)_mm256_extract_epi32(entries, 0);
+        uint32_t hi = (uint32_t)_mm256_extract_epi32(entries, 4);
+        memcpy(indexed + i, &lo, 4);
+        memcpy(indexed + i + 4, &hi, 4);
+    }
+    remap_pixels_scalar(rgba + (i * 4), pixel_count - i, lut, indexed + i);
+}
+
+void remap_nearest(const liq_palette *palette, const uint16_t *keys, int key_count, unsigned char *nearest_entry) {
+    nearest(palette, keys, 0, key_count, nearest_entry);
+}
+
+void remap_pixels(const unsigned char *rgba, size_t pixel_count, const unsigned char *lut, unsigned char *indexed) {
+    switch (pick_kernel()) {
+        case KERNEL_AVX2:
+            remap_pixels_avx2(rgba, pixel_count, lut, indexed);
+            break;
+        case KERNEL_SSE4:
+            remap_pixels_sse4(rgba, pixel_count, lut, indexed);
+            break;
+        default:
+            remap_pixels_scalar(rgba, pixel_count, lut, indexed);
+            break;
+    }
+}
+
+static void count_keys_scalar(const unsigned char *rgba, size_t pixel_count, uint32_t *histogram) {
+    for (size_t i = 0; i < pixel_count; i++) {
+        const unsigned char *px = rgba + (i * 4);
+        histogram[((px[0] >> 3) << 10) | ((px[1] >> 3) << 5) | (px[2] >> 3)]++;
+    }
+}
+
+__attribute__((target("sse4.1")))
+static void count_keys_sse4(const unsigned char *rgba, size_t pixel_count, uint32_t *histogram) {
+    size_t i = 0;
+    for (; i + 4 <= pixel_count; i += 4) {
+        __m128i keys = keys_sse4(_mm_loadu_si128((const __m128i *)(rgba + (i * 4))));
+        histogram[_mm_extract_epi32(keys, 0)]++;
+        histogram[_mm_extract_epi32(keys, 1)]++;
+        histogram[_mm_extract_epi32(keys, 2)]++;
+        histogram[_mm_extract_epi32(keys, 3)]++;
+    }
+    count_keys_scalar(rgba + (i * 4), pixel_count - i, histogram);
+}
+
+//the keys are vectorized, the increments can't be (neighbours often share a key)
+__attribute__((target("avx2")))
+static void count_keys_avx2(const unsigned char *rgba, size_t pixel_count, uint32_t *histogram) {
+    const __m256i mask = _mm256_set1_epi32(0x1F);
+    uint32_t keys[8];
+    size_t i = 0;
+    for (; i + 8 <= pixel_count; i += 8) {
+        __m256i px = _mm256_loadu_si256((const __m256i *)(rgba + (i * 4)));
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(px, 3), mask);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 11), mask);
+        __m256i b = _mm256_and_si256(_mm256_srli_epi32(px, 19), mask);
+        _mm256_storeu_si256((__m256i *)keys, _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 10), _mm256_slli_epi32(g, 5)), b));
+        for (int k = 0; k < 8; k++) {
+            histogram[keys[k]]++;
+        }
+    }
+    count_keys_scalar(rgba + (i * 4), pixel_count - i, histogram);
+}
+
+void remap_histogram(const unsigned char *rgba, size_t pixel_count, uint32_t *histogram) {
+    switch (pick_kernel()) {
+        case KERNEL_AVX2:
+            count_keys_avx2(rgba, pixel_count, histogram);
+            break;
+        case KERNEL_SSE4:
+            count_keys_sse4(rgba, pixel_count, histogram);
+            break;
+        default:
+            count_keys_scalar(rgba, pixel_count, histogram);
+            break;
+    }
+}
+
+static unsigned char dither_channel(unsigned char v, unsigned char add, unsigned char sub) {
+    int out = v + add;
+    out = (out > 255) ? 255 : out;
+    out -= sub;
+    return (unsigned char)((out < 0) ? 0 : out);
+}
+
+//x is the row position of rgba[0], so the kernels can hand over their leftover pixels
+static void dither_row_scalar(const unsigned char *rgba, int x, int count, const unsigned char *add,
+                              const unsigned char *sub, const unsigned char *lut, unsigned char *indexed) {
+    for (int i = 0; i < count; i++, x++) {
+        const unsigned char *px = rgba + (i * 4);
+        int t = (x & (DITHER_TILE - 1)) * 4;
+        unsigned char r = dither_channel(px[0], add[t + 0], sub[t + 0]);
+        unsigned char g = dither_channel(px[1], add[t + 1], sub[t + 1]);
+        unsigned char b = dither_channel(px[2], add[t + 2], sub[t + 2]);
+        indexed[i] = lut[((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3)];
+    }
+}
+
+//the tile row is 32 pixels, so a 4 pixel step never straddles its end
+__attribute__((target("sse4.1")))
+static void dither_row_sse4(const unsigned char *rgba, int width, const unsigned char *add,
+                            const unsigned char *sub, const unsigned char *lut, unsigned char *indexed) {
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        int t = (x & (DITHER_TILE - 1)) * 4;
+        __m128i px = _mm_loadu_si128((const __m128i *)(rgba + (x * 4)));
+        px = _mm_subs_epu8(_mm_adds_epu8(px, _mm_loadu_si128((const __m128i *)(add + t))),
+                           _mm_loadu_si128((const __m128i *)(sub + t)));
+        __m128i keys = keys_sse4(px);
+        indexed[x + 0] = lut[_mm_extract_epi32(keys, 0)];
+        indexed[x + 1] = lut[_mm_extract_epi32(keys, 1)];
+        indexed[x + 2] = lut[_mm_extract_epi32(keys, 2)];
+        indexed[x + 3] = lut[_mm_extract_epi32(keys, 3)];
+    }
+    dither_row_scalar(rgba + (x * 4), x, width - x, add, sub, lut, indexed + x);
+}
+
+__attribute__((target("avx2")))
+static void dither_row_avx2(const unsigned char *rgba, int width, const unsigned char *add,
+                            const unsigned char *sub, const unsigned char *lut, unsigned char *indexed) {
+    const __m256i mask = _mm256_set1_epi32(0x1F);
+    const __m256i low_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                               0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        int t = (x & (DITHER_TILE - 1)) * 4;
+        __m256i px = _mm256_loadu_si256((const __m256i *)(rgba + (x * 4)));
+        px = _mm256_subs_epu8(_mm256_adds_epu8(px, _mm256_loadu_si256((const __m256i *)(add + t))),
+                              _mm256_loadu_si256((const __m256i *)(sub + t)));
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(px, 3), mask);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 11), mask);
+        __m256i b = _mm256_and_si256(_mm256_srli_epi32(px, 19), mask);
+        __m256i keys = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 10), _mm256_slli_epi32(g, 5)), b);
+
+        __m256i entries = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *)lut, keys, 1), low_bytes);
+        uint32_t lo = (uint32_t)_mm256_extract_epi32(entries, 0);
+        uint32_t hi = (uint32_t)_mm256_extract_epi32(entries, 4);
+        memcpy(indexed + x, &lo, 4);
+        memcpy(indexed + x + 4, &hi, 4);
+    }
+    dither_row_scalar(rgba + (x * 4), x, width - x, add, sub, lut, indexed + x);
+}
+
+void remap_pixels_dithered(const unsigned char *rgba, int width, int first_row, int last_row,
+                           const unsigned char *lut, const DitherTile *tile, unsigned char *indexed) {
+    RemapKernel kernel = pick_kernel();
+    for (int y = first_row; y < last_row; y++) {
+        //the pattern is anchored to the pixel grid, so still areas dither the same way every frame
+        size_t row = (size_t)y * width;
+        int t = (y & (DITHER_TILE - 1)) * DITHER_TILE * 4;
+        switch (kernel) {
+            case KERNEL_AVX2:
+                dither_row_avx2(rgba + (row * 4), width, tile->add + t, tile->sub + t, lut, indexed + row);
+                break;
+            case KERNEL_SSE4:
+                dither_row_sse4(rgba + (row * 4), width, tile->add + t, tile->sub + t, lut, indexed + row);
+                break;
+            default:
+                dither_row_scalar(rgba + (row * 4), 0, width, tile->add + t, tile->sub + t, lut, indexed + row);
+                break;
+        }
+    }
+}
+
+const char *remap_kernel_name(void) {
+    switch (pick_kernel()) {
+        case KERNEL_AVX2:
+            return "avx2";
+        case KERNEL_SSE4:
+            return "sse4";
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: rgb555 lookup table remapping
+ *--------------------------------------
+*/
+
+#ifndef FBIN_REMAP_H
+#define FBIN_REMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../include/libimagequant.h"
+#include "dither.h"
+
+//one entry per rgb555 color, padded so a 32-bit gather at the last entry stays inside
+#define REMAP_LUT_SIZE (32768 + 4)
+
+//fills lut[rgb555] with the nearest palette entry, compared at the 5 bits per channel the
+//output keeps (ties go to the lower index)
+//the keys are cut into 'bands' ranges and only range 'band' is filled, so several threads
+//can build one table (band 0 of 1 builds all of it)
+void remap_build_lut(const liq_palette *palette, unsigned char *lut, int band, int bands);
+//the same search for a list of rgb555 keys: nearest_entry[i] for keys[i]
+void remap_nearest(const liq_palette *palette, const uint16_t *keys, int key_count, unsigned char *nearest_entry);
+//indexed[i] = lut[rgb555 of pixel i]
+void remap_pixels(const unsigned char *rgba, size_t pixel_count, const unsigned char *lut, unsigned char *indexed);
+//adds one to histogram[rgb555 of pixel i] for every pixel (32768 counters)
+void remap_histogram(const unsigned char *rgba, size_t pixel_count, uint32_t *histogram);
+//same for rows [first_row, last_row) of a whole frame, with the tile's offsets applied
+//to each pixel before the lookup
+void remap_pixels_dithered(const unsigned char *rgba, int width, int first_row, int last_row,
+                           const unsigned char *lut, const DitherTile *tile, unsigned char *indexed);
+//the kernel picked for this cpu: avx2, sse4 or scalar
+const char *remap_kernel_name(void);
+
+#endif
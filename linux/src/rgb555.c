@@ -0,0 +1,205 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Native 15-bit quantizer
+ *--------------------------------------
+*/
+
+#include "rgb555.h"
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    uint16_t color;     //rgb555 key
+    uint32_t count;
+} ColorCount;
+
+//a run of colors[] that becomes one palette entry
+typedef struct {
+    int start, length;
+    uint64_t weight;
+    double error;       //weighted variance, the box with the most is split next
+    int axis;           //widest channel: 0 = r, 1 = g, 2 = b
+} Box;
+
+static int channel(uint16_t color, int axis) {
+    return (color >> (10 - (axis * 5))) & 0x1F;
+}
+
+static unsigned char expand5(int value) {
+    return RGB555_EXPAND(value);
+}
+
+static void measure_box(const ColorCount *colors, Box *box) {
+    uint64_t sum[3] = {0, 0, 0}, sum_sq[3] = {0, 0, 0};
+    int lo[3] = {31, 31, 31}, hi[3] = {0, 0, 0};
+
+    box->weight = 0;
+    for (int i = box->start; i < box->start + box->length; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            uint64_t c = channel(colors[i].color, axis);
+            sum[axis] += c * colors[i].count;
+            sum_sq[axis] += c * c * colors[i].count;
+            lo[axis] = ((int)c < lo[axis]) ? (int)c : lo[axis];
+            hi[axis] = ((int)c > hi[axis]) ? (int)c : hi[axis];
+        }
+        box->weight += colors[i].count;
+    }
+
+    box->error = 0.0;
+    box->axis = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        box->error += (double)sum_sq[axis] - ((double)sum[axis] * sum[axis] / box->weight);
+        if ((hi[axis] - lo[axis]) > (hi[box->axis] - lo[box->axis])) {
+            box->axis = axis;
+        }
+    }
+    if (box->length < 2) {
+        box->error = -1.0;
+    }
+}
+
+//counting sort on one 5-bit channel, then cut at the weighted median
+static void split_box(ColorCount *colors, ColorCount *scratch, Box *box, Box *upper) {
+    int buckets[33] = {0};
+    for (int i = box->start; i < box->start + box->length; i++) {
+        buckets[channel(colors[i].color, box->axis) + 1]++;
+    }
+    for (int v = 1; v < 33; v++) {
+        buckets[v] += buckets[v - 1];
+    }
+    for (int i = box->start; i < box->start + box->length; i++) {
+        scratch[buckets[channel(colors[i].color, box->axis)]++] = colors[i];
+    }
+    memcpy(colors + box->start, scratch, box->length * sizeof(ColorCount));
+
+    uint64_t half = box->weight / 2, seen = 0;
+    int cut = 1;
+    for (int i = 0; i < box->length - 1; i++) {
+        seen += colors[box->start + i].count;
+        cut = i + 1;
+        if (seen >= half) {
+            break;
+        }
+    }
+
+    upper->start = box->start + cut;
+    upper->length = box->length - cut;
+    box->length = cut;
+    measure_box(colors, box);
+    measure_box(colors, upper);
+}
+
+//closest 555 color to the mean that no other entry took, searched in growing cubes around it
+static uint16_t nearest_unused(const uint8_t *used, const int *mean) {
+    int best = -1, best_distance = 0;
+    for (int radius = 1; radius < 32; radius++) {
+        for (int r = mean[0] - radius; r <= mean[0] + radius; r++) {
+            for (int g = mean[1] - radius; g <= mean[1] + radius; g++) {
+                for (int b = mean[2] - radius; b <= mean[2] + radius; b++) {
+                    if ((r < 0) || (r > 31) || (g < 0) || (g > 31) || (b < 0) || (b > 31)) {
+                        continue;
+                    }
+                    int key = (r << 10) | (g << 5) | b;
+                    int distance = ((r - mean[0]) * (r - mean[0])) + ((g - mean[1]) * (g - mean[1])) + ((b - mean[2]) * (b - mean[2]));
+                    if (!used[key] && ((best < 0) || (distance < best_distance))) {
+                        best = key;
+                        best_distance = distance;
+                    }
+                }
+            }
+        }
+        //anything outside this cube is further away than radius
+        if ((best >= 0) && (best_distance <= radius * radius)) {
+            break;
+        }
+    }
+    return (uint16_t)best;
+}
+
+int rgb555_median_cut(Arena *arena, const uint32_t *histogram, int num_colors, liq_palette *palette) {
+    ColorCount *colors = arena_alloc(arena, RGB555_COLORS * sizeof(ColorCount));
+    ColorCount *scratch = arena_alloc(arena, RGB555_COLORS * sizeof(ColorCount));
+    Box *boxes = arena_alloc(arena, num_colors * sizeof(Box));
+    uint8_t *used = arena_alloc(arena, RGB555_COLORS);
+    if (!colors || !scratch || !boxes || !used) {
+        return 1;
+    }
+
+    int distinct = 0;
+    for (int key = 0; key < RGB555_COLORS; key++) {
+        if (histogram[key]) {
+            colors[distinct].color = (uint16_t)key;
+            colors[distinct].count = histogram[key];
+            distinct++;
+        }
+    }
+
+    //keep splitting the box with the largest error until there is one per color
+    int box_count = 1;
+    boxes[0].start = 0;
+    boxes[0].length = distinct;
+    measure_box(colors, &boxes[0]);
+    while (box_count < num_colors) {
+        int widest = 0;
+        for (int i = 1; i < box_count; i++) {
+            if (boxes[i].error > boxes[widest].error) {
+                widest = i;
+            }
+        }
+        if (boxes[widest].error < 0.0) {
+            break;  //every box is down to one color
+        }
+        split_box(colors, scratch, &boxes[widest], &boxes[box_count]);
+        box_count++;
+    }
+
+    //each entry is its box's weighted mean, or its most common color no other entry took,
+    //or the free color closest to the mean when the box has none left
+    memset(palette, 0, sizeof(liq_palette));
+    palette->count = num_colors;
+    memset(used, 0, RGB555_COLORS);
+    for (int i = 0; i < box_count; i++) {
+        uint64_t sum[3] = {0, 0, 0};
+        uint32_t most = 0;
+        int common = -1;
+        for (int c = boxes[i].start; c < boxes[i].start + boxes[i].length; c++) {
+            for (int axis = 0; axis < 3; axis++) {
+                sum[axis] += (uint64_t)channel(colors[c].color, axis) * colors[c].count;
+            }
+            if (!used[colors[c].color] && (colors[c].count > most)) {
+                most = colors[c].count;
+                common = colors[c].color;
+            }
+        }
+        int mean[3];
+        for (int axis = 0; axis < 3; axis++) {
+            mean[axis] = (int)((sum[axis] + (boxes[i].weight / 2)) / boxes[i].weight);
+        }
+        uint16_t color = (uint16_t)((mean[0] << 10) | (mean[1] << 5) | mean[2]);
+        if (used[color]) {
+            color = (common >= 0) ? (uint16_t)common : nearest_unused(used, mean);
+        }
+        used[color] = 1;
+        palette->entries[i].r = expand5(channel(color, 0));
+        palette->entries[i].g = expand5(channel(color, 1));
+        palette->entries[i].b = expand5(channel(color, 2));
+        palette->entries[i].a = 255;
+    }
+    //fewer colors than entries, the rest are filled with distinct unused colors
+    int key = 0;
+    for (int i = box_count; i < num_colors; i++) {
+        while (used[key]) {
+            key++;
+        }
+        used[key] = 1;
+        palette->entries[i].r = expand5(channel((uint16_t)key, 0));
+        palette->entries[i].g = expand5(channel((uint16_t)key, 1));
+        palette->entries[i].b = expand5(channel((uint16_t)key, 2));
+        palette->entries[i].a = 255;
+    }
+    return 0;
+}
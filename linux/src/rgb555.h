@@ -0,0 +1,31 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Native 15-bit quantizer
+ *--------------------------------------
+*/
+
+#ifndef FBIN_RGB555_H
+#define FBIN_RGB555_H
+
+#include <stdint.h>
+
+#include "../include/libimagequant.h"
+#include "arena.h"
+
+#define RGB555_COLORS 32768
+
+//rgb555 key of an 8-bit color, the same bits the writer keeps
+#define RGB555_KEY(r, g, b) ((((r) >> 3) << 10) | (((g) >> 3) << 5) | ((b) >> 3))
+//5-bit channel back to 8 bits, the writer keeps the top 5 bits so this maps straight back
+#define RGB555_EXPAND(v) ((unsigned char)(((v) << 3) | ((v) >> 2)))
+
+//median cut over the RGB555_COLORS counts of a frame, in 5-bit space: every palette
+//entry is an exact rgb555 color, so none of them merge when the palette is written.
+//a frame with fewer colors than num_colors gets distinct unused colors for the rest
+//scratch memory comes from the arena. returns 0 on success, 1 when out of memory
+int rgb555_median_cut(Arena *arena, const uint32_t *histogram, int num_colors, liq_palette *palette);
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Scene cut detection
+ *--------------------------------------
+*/
+
+#include "scene.h"
+
+#include <string.h>
+
+void scene_signature(const unsigned char *rgba, size_t pixel_count, unsigned int *signature) {
+    memset(signature, 0, SCENE_BINS * sizeof(unsigned int));
+    for (size_t i = 0; i < pixel_count; i++) {
+        const unsigned char *px = rgba + (i * 4);
+        signature[((px[0] >> 6) << 4) | ((px[1] >> 6) << 2) | (px[2] >> 6)]++;
+    }
+}
+
+int scene_difference(const unsigned int *a, const unsigned int *b, size_t pixel_count) {
+    unsigned long long moved = 0;
+    for (int i = 0; i < SCENE_BINS; i++) {
+        moved += (a[i] > b[i]) ? (a[i] - b[i]) : (b[i] - a[i]);
+    }
+    //every pixel that moves leaves one bin and lands in another
+    return (int)((moved * 100) / (2 * pixel_count));
+}
@@ -0,0 +1,23 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Scene cut detection
+ *--------------------------------------
+*/
+
+#ifndef FBIN_SCENE_H
+#define FBIN_SCENE_H
+
+#include <stddef.h>
+
+//colors are binned 2 bits per channel, coarse enough to ignore motion and noise
+#define SCENE_BINS 64
+
+//counts the pixels of an rgba frame in each color bin
+void scene_signature(const unsigned char *rgba, size_t pixel_count, unsigned int *signature);
+//percentage (0-100) of pixels that would have to change bins to turn one frame into the other
+int scene_difference(const unsigned int *a, const unsigned int *b, size_t pixel_count);
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Adaptive quantization speed
+ *--------------------------------------
+*/
+
+#include "speed.h"
+
+#include <stdio.h>
+
+//weight of the newest frame in the moving average
+#define SPEED_SMOOTHING 0.25
+//slow down again only below this share of the budget, one speed step is
+//roughly this much work, so the controller doesn't flip back and forth
+#define SPEED_SLACK 0.6
+
+void speed_control_init(SpeedControl *sc, double target_fps, int workers) {
+    sc->frame_budget = workers / target_fps;
+    //frames already running at the old speed report after a change, skip them
+    sc->settle_frames = workers + 2;
+    atomic_init(&sc->speed, SPEED_DEFAULT);
+    sc->average = 0.0;
+    sc->samples = 0;
+    for (int i = 0; i <= SPEED_MAX; i++) {
+        atomic_init(&sc->frames_at[i], 0);
+    }
+}
+
+int speed_control_speed(SpeedControl *sc) {
+    return atomic_load(&sc->speed);
+}
+
+void speed_control_update(SpeedControl *sc, long long frame_index, int speed, int frames, double seconds) {
+    atomic_fetch_add(&sc->frames_at[speed], frames);
+    seconds /= frames;
+
+    #pragma omp critical (speed_control)
+    {
+        int current = atomic_load(&sc->speed);
+        if (speed == current) {
+            sc->average = (sc->samples == 0) ? seconds : (sc->average + (SPEED_SMOOTHING * (seconds - sc->average)));
+            sc->samples++;
+        }
+
+        int next = current;
+        if (sc->samples >= sc->settle_frames) {
+            if ((sc->average > sc->frame_budget) && (current < SPEED_MAX)) {
+                next = current + 1;
+            } else if ((sc->average < sc->frame_budget * SPEED_SLACK) && (current > SPEED_MIN)) {
+                next = current - 1;
+            }
+        }
+        if (next != current) {
+            printf("\r\033[Kframe %lld: speed %d -> %d (%.1f ms per frame, budget %.1f ms)\n",
+                   frame_index + 1, current, next, sc->average * 1000.0, sc->frame_budget * 1000.0);
+            atomic_store(&sc->speed, next);
+            sc->samples = 0;
+        }
+    }
+}
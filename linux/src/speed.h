@@ -0,0 +1,38 @@
+/*
+ *--------------------------------------
+ * Program Name: FBin
+ * Author: William "WillDaBeast555" Wierzbowski
+ * License: GPL v3
+ * Description: Adaptive quantization speed
+ *--------------------------------------
+*/
+
+#ifndef FBIN_SPEED_H
+#define FBIN_SPEED_H
+
+#include <stdatomic.h>
+
+//libimagequant's speed range, 1 = slowest / best, 10 = fastest
+#define SPEED_MIN 1
+#define SPEED_MAX 10
+#define SPEED_DEFAULT 4
+
+//steers liq_set_speed so the workers together hit a frame rate: each worker may spend
+//workers / target_fps seconds per frame, a slower average raises the speed, a much
+//faster one lowers it again
+typedef struct {
+    double frame_budget;        //seconds per frame on one worker
+    int settle_frames;          //samples to wait after a change before judging the new speed
+    atomic_int speed;
+    double average;             //moving average of the frame time at the current speed
+    int samples;
+    atomic_llong frames_at[SPEED_MAX + 1];
+} SpeedControl;
+
+void speed_control_init(SpeedControl *sc, double target_fps, int workers);
+int speed_control_speed(SpeedControl *sc);
+//records that 'frames' frames from frame_index on took 'seconds' at 'speed', and picks
+//the speed for the next frames, every change is logged with the frame it happened at
+void speed_control_update(SpeedControl *sc, long long frame_index, int speed, int frames, double seconds);
+
+#endif